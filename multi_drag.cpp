@@ -1,242 +1,6543 @@
 #include <SDL2/SDL.h>
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "scene_file.h"
+#if !defined(_WIN32)
+#include "scene_share.h"
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_AVX2_TARGET 1
+#endif
+
 // Compile with:
-// g++ multi_drag.cpp -o multi_drag $(pkg-config --cflags --libs SDL2)
-// g++ multi_drag.cpp -o multi_drag -lSDL2
+// g++ -O2 -pthread multi_drag.cpp -o multi_drag $(pkg-config --cflags --libs SDL2)
+// g++ -O2 -pthread multi_drag.cpp -o multi_drag -lSDL2
+// (on Linux with glibc before 2.34, add -lrt for --share)
 
 // Run with:
-// ./multi_drag
+// ./multi_drag [--populate N] [--replay-pointers N] [--frames N] [--seed N]
+//              [--backend sdl|software|surface] [--threads N]
+//              [--commands FILE] [--sprites] [--atlas] [--sprite-budget MB]
+//              [--images DIR] [--image-budget MB]
+//              [--dynamic-res] [--target-fps N] [--scene FILE]
+//              [--journal] [--journal-ms N] [--import FILE]
+//              [--export FILE] [--history-mb MB] [--checkpoint FILE]
+//              [--share NAME]
+//
+// With --frames the average render time is printed on exit, so backends can
+// be compared on the same scene, e.g.
+// ./multi_drag --backend software --populate 2000000 --seed 1 --frames 300
+//
+// F2 dumps the current frame's render commands to commands-N.txt; --commands
+// renders such a dump every frame instead of the scene.
+//
+// --sprites (or S) draws each object as one copy of a cached texture baked
+// per distinct size and colors; --sprite-budget caps the cache's memory.
+// --atlas packs those images into a few large textures instead, drawing runs
+// of them with one SDL_RenderGeometry call.
+//
+// --images adds every BMP in a directory as an image object; BMPs can also
+// be dropped on the window. They are decoded in the background and shown
+// as gray placeholders until ready. Each is kept as a mip pyramid; levels
+// finer than 64x64 are dropped past --image-budget and decoded again when
+// zoomed into.
+//
+// --dynamic-res (or R) draws the scene into an offscreen target at a lower
+// resolution when render time exceeds the --target-fps budget, and
+// stretches it over the window.
+//
+// Ctrl+S saves the scene to --scene (scene.mds by default), which is loaded
+// on start when it exists. The file format is described in scene_file.h.
+// C recolors and Delete removes the selected objects. Ctrl+Z undoes and
+// Ctrl+Y (or Ctrl+Shift+Z) redoes; the history is capped at --history-mb.
+//
+// --import adds the rects of a CSV file with lines "x,y,w,h,rrggbbaa" or
+// "x,y,w,h,r,g,b,a"; CSV files can also be dropped on the window. E exports
+// the scene in stacking order to --export (scene.svg by default) in the
+// background, as SVG or, for other extensions, as CSV in the first format.
+//
+// --journal appends every edit to <scene>.journal.N files, synced every
+// --journal-ms (100 by default), and replays them on start, so edits
+// survive a crash without saving the whole scene. Past 16 MB of journal
+// the scene is saved and the journal files it covers deleted.
+//
+// --checkpoint writes the scene together with its spatial index, LOD tiles
+// and camera to FILE on exit, and resumes from it on start unless --scene
+// was saved later. The indexes are copied back instead of rebuilt, so
+// large scenes are ready without reading every object.
+//
+// --share publishes the objects in the POSIX shared memory segment NAME
+// (e.g. /multi_drag) after every frame's input, for other processes to read
+// in place; scene_share.h has the layout and a reader, and scene_watch.cpp
+// is an example. Not available on Windows.
 
 class SDLApp
 {
 private:
   static constexpr int WINDOW_WIDTH = 800;
   static constexpr int WINDOW_HEIGHT = 600;
+  static constexpr const char *WINDOW_TITLE = "Multiple Draggable Objects Demo";
+
+  // Objects live in world coordinates; the window shows a camera view
+  static constexpr int WORLD_WIDTH = 100000;
+  static constexpr int WORLD_HEIGHT = 100000;
 
   struct SDL_Deleter
   {
     void operator()(SDL_Window *w) const { SDL_DestroyWindow(w); }
     void operator()(SDL_Renderer *r) const { SDL_DestroyRenderer(r); }
+    void operator()(SDL_Texture *t) const { SDL_DestroyTexture(t); }
   };
 
   std::unique_ptr<SDL_Window, SDL_Deleter> window;
   std::unique_ptr<SDL_Renderer, SDL_Deleter> renderer;
 
-  class DraggableObject
+  // Drags are keyed by (touch device, finger); the mouse has its own key
+  using PointerId = std::pair<SDL_TouchID, SDL_FingerID>;
+  static constexpr PointerId MOUSE_POINTER{-1, -1};
+
+  // Translates packed coordinates by one delta and clamps each result to
+  // [0, limit[i]]. Runs four lanes at a time on SSE2; the tail (and
+  // non-x86 builds) take the scalar path.
+  static void translateClamped(const int *start, const int *limit, int *out,
+                               size_t count, int delta)
+  {
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i d = _mm_set1_epi32(delta);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4)
+    {
+      __m128i v = _mm_add_epi32(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(start + i)), d);
+      __m128i lim =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(limit + i));
+      // max(v, 0) then min(v, lim); SSE2 has no 32-bit min/max
+      v = _mm_and_si128(v, _mm_cmpgt_epi32(v, zero));
+      __m128i over = _mm_cmpgt_epi32(v, lim);
+      v = _mm_or_si128(_mm_and_si128(over, lim), _mm_andnot_si128(over, v));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), v);
+    }
+#endif
+    for (; i < count; ++i)
+    {
+      out[i] = std::clamp(start[i] + delta, 0, limit[i]);
+    }
+  }
+
+  // Uniform grid over the world. Each cell lists the slots whose rect
+  // overlaps it, and spans remembers every slot's cell range so updates and
+  // queries need not be told the previous rect.
+  class SpatialGrid
   {
   public:
-    SDL_Rect rect;
-    SDL_Color color;
-    bool isDragging;
-    int dragOffsetX;
-    int dragOffsetY;
+    static constexpr int CELL_SIZE = 256;
+    static constexpr int COLUMNS = (WORLD_WIDTH + CELL_SIZE - 1) / CELL_SIZE;
+    static constexpr int ROWS = (WORLD_HEIGHT + CELL_SIZE - 1) / CELL_SIZE;
+
+    // Inclusive range of cells covered by a rect
+    struct Span
+    {
+      int x0, y0, x1, y1;
+
+      bool operator==(const Span &other) const
+      {
+        return x0 == other.x0 && y0 == other.y0 && x1 == other.x1 &&
+               y1 == other.y1;
+      }
+    };
+
+  private:
+    std::vector<std::vector<Uint32>> cells;
+    std::vector<Span> spans;
+
+    static Span spanOf(const SDL_Rect &rect)
+    {
+      return Span{std::clamp(rect.x / CELL_SIZE, 0, COLUMNS - 1),
+                  std::clamp(rect.y / CELL_SIZE, 0, ROWS - 1),
+                  std::clamp((rect.x + rect.w - 1) / CELL_SIZE, 0, COLUMNS - 1),
+                  std::clamp((rect.y + rect.h - 1) / CELL_SIZE, 0, ROWS - 1)};
+    }
+
+    void link(Uint32 slot, const Span &span)
+    {
+      for (int cy = span.y0; cy <= span.y1; ++cy)
+      {
+        for (int cx = span.x0; cx <= span.x1; ++cx)
+        {
+          cells[cy * COLUMNS + cx].push_back(slot);
+        }
+      }
+    }
+
+    void unlink(Uint32 slot, const Span &span)
+    {
+      for (int cy = span.y0; cy <= span.y1; ++cy)
+      {
+        for (int cx = span.x0; cx <= span.x1; ++cx)
+        {
+          std::vector<Uint32> &cell = cells[cy * COLUMNS + cx];
+          auto it = std::find(cell.begin(), cell.end(), slot);
+          *it = cell.back();
+          cell.pop_back();
+        }
+      }
+    }
+
+  public:
+    SpatialGrid() : cells(COLUMNS * ROWS) {}
+
+    void insert(size_t slot, const SDL_Rect &rect)
+    {
+      spans.resize(std::max(spans.size(), slot + 1));
+      spans[slot] = spanOf(rect);
+      link(static_cast<Uint32>(slot), spans[slot]);
+    }
 
-    DraggableObject(int x, int y, int w, int h, SDL_Color c)
-        : isDragging(false), dragOffsetX(0), dragOffsetY(0), color(c)
+    // Cheap when the rect stays within the same cells, which is the common
+    // case for drags since cells are much larger than a motion step
+    void update(size_t slot, const SDL_Rect &rect)
     {
-      rect.x = x;
-      rect.y = y;
-      rect.w = w;
-      rect.h = h;
+      Span span = spanOf(rect);
+      if (span == spans[slot])
+      {
+        return;
+      }
+      unlink(static_cast<Uint32>(slot), spans[slot]);
+      spans[slot] = span;
+      link(static_cast<Uint32>(slot), span);
     }
 
-    bool containsPoint(int x, int y) const
+    // The slot must not be updated or removed again
+    void remove(size_t slot) { unlink(static_cast<Uint32>(slot), spans[slot]); }
+
+    // Inserts slots [first, first + count) in one go: the cells are sized
+    // for all of them before any is linked, so each list grows only once
+    template <typename RectOf>
+    void insertRange(size_t first, size_t count, RectOf &&rectOf)
     {
-      return x >= rect.x && x < rect.x + rect.w && y >= rect.y &&
-             y < rect.y + rect.h;
+      spans.resize(std::max(spans.size(), first + count));
+      std::vector<size_t> added(cells.size());
+      for (size_t slot = first; slot < first + count; ++slot)
+      {
+        const Span &span = spans[slot] = spanOf(rectOf(slot));
+        for (int cy = span.y0; cy <= span.y1; ++cy)
+        {
+          for (int cx = span.x0; cx <= span.x1; ++cx)
+          {
+            ++added[cy * COLUMNS + cx];
+          }
+        }
+      }
+      for (size_t cell = 0; cell < cells.size(); ++cell)
+      {
+        cells[cell].reserve(cells[cell].size() + added[cell]);
+      }
+      for (size_t slot = first; slot < first + count; ++slot)
+      {
+        link(static_cast<Uint32>(slot), spans[slot]);
+      }
     }
 
-    void drag(int mouseX, int mouseY)
+    // For checkpoints: the slots of every cell, and every slot's span
+    // (stale for removed slots)
+    const std::vector<std::vector<Uint32>> &cellLists() const { return cells; }
+    const std::vector<Span> &spanList() const { return spans; }
+
+    // Takes over cells and spans as cellLists() and spanList() gave them,
+    // with cell c's slots flattened to slots[starts[c], starts[c + 1])
+    void restore(const Uint64 *starts, const Uint32 *slots,
+                 const Span *spanData, size_t spanCount)
     {
-      if (isDragging)
+      for (size_t cell = 0; cell < cells.size(); ++cell)
       {
-        rect.x = mouseX - dragOffsetX;
-        rect.y = mouseY - dragOffsetY;
+        cells[cell].assign(slots + starts[cell], slots + starts[cell + 1]);
+      }
+      spans.assign(spanData, spanData + spanCount);
+    }
 
-        // Keep within window bounds
-        rect.x = std::clamp(rect.x, 0, WINDOW_WIDTH - rect.w);
-        rect.y = std::clamp(rect.y, 0, WINDOW_HEIGHT - rect.h);
+    // Calls visit once for every slot whose cells overlap the area. A slot
+    // spanning several cells is reported only from the first of them that
+    // lies inside the queried range.
+    template <typename Visit>
+    void query(const SDL_Rect &area, Visit &&visit) const
+    {
+      Span range = spanOf(area);
+      for (int cy = range.y0; cy <= range.y1; ++cy)
+      {
+        for (int cx = range.x0; cx <= range.x1; ++cx)
+        {
+          for (Uint32 slot : cells[cy * COLUMNS + cx])
+          {
+            const Span &span = spans[slot];
+            if (cx == std::max(range.x0, span.x0) &&
+                cy == std::max(range.y0, span.y0))
+            {
+              visit(static_cast<size_t>(slot));
+            }
+          }
+        }
       }
     }
   };
 
-  class ObjectManager
+  // Per-tile aggregates for drawing zoomed-out views. Each object counts
+  // towards the tile holding its center; the sums are kept up to date as
+  // objects are added and moved, so switching a tile to its aggregate costs
+  // nothing per object. Objects can reach past their tile, so each tile
+  // also keeps how far, for views to find the tiles outside them whose
+  // objects overlap them.
+  class LodTiles
   {
+  public:
+    static constexpr int TILE_SIZE = 1024;
+    static constexpr int COLUMNS = (WORLD_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    static constexpr int ROWS = (WORLD_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+
+    // Color sums are weighted by object area
+    struct Tile
+    {
+      Uint32 count = 0;
+      Uint64 area = 0;
+      Uint64 r = 0;
+      Uint64 g = 0;
+      Uint64 b = 0;
+    };
+
   private:
-    std::vector<DraggableObject> objects;
-    std::mt19937 rng;
-    std::uniform_int_distribution<int> colorDist;
+    std::vector<Tile> tiles;
+    // Largest distance an object of the tile reaches past it, and of any
+    // tile. They only grow until the tile empties, so may overestimate.
+    std::vector<int> reach;
+    int maxReach = 0;
+
+    static int tileOf(const SDL_Rect &rect)
+    {
+      int cx = std::clamp((rect.x + rect.w / 2) / TILE_SIZE, 0, COLUMNS - 1);
+      int cy = std::clamp((rect.y + rect.h / 2) / TILE_SIZE, 0, ROWS - 1);
+      return cy * COLUMNS + cx;
+    }
+
+    static SDL_Rect areaOf(int index)
+    {
+      return SDL_Rect{index % COLUMNS * TILE_SIZE, index / COLUMNS * TILE_SIZE,
+                      TILE_SIZE, TILE_SIZE};
+    }
+
+    void apply(int index, const SDL_Rect &rect, const SDL_Color &color,
+               int sign)
+    {
+      Tile &tile = tiles[index];
+      Uint64 area = static_cast<Uint64>(rect.w) * rect.h;
+      tile.count += sign;
+      tile.area += sign * area;
+      tile.r += sign * area * color.r;
+      tile.g += sign * area * color.g;
+      tile.b += sign * area * color.b;
+      if (tile.count == 0)
+      {
+        reach[index] = 0;
+      }
+      else if (sign > 0)
+      {
+        extend(index, rect);
+      }
+    }
+
+    void extend(int index, const SDL_Rect &rect)
+    {
+      // The center may sit anywhere in the tile, so the object reaches at
+      // most its larger half extent past it
+      int past = std::max(rect.w, rect.h) / 2 + 1;
+      reach[index] = std::max(reach[index], past);
+      maxReach = std::max(maxReach, past);
+    }
 
   public:
-    ObjectManager() : rng(std::random_device{}()), colorDist(0, 255)
+    LodTiles() : tiles(COLUMNS * ROWS), reach(COLUMNS * ROWS) {}
+
+    void add(const SDL_Rect &rect, const SDL_Color &color)
     {
-      // Create some initial objects
-      addObject(100, 100);
-      addObject(300, 200);
-      addObject(500, 300);
+      apply(tileOf(rect), rect, color, 1);
     }
 
-    SDL_Color generateRandomColor()
+    // Records the extent of an object already counted, for tiles restored
+    // from a checkpoint, which holds only the sums
+    void extend(const SDL_Rect &rect) { extend(tileOf(rect), rect); }
+
+    void remove(const SDL_Rect &rect, const SDL_Color &color)
     {
-      return SDL_Color{static_cast<Uint8>(colorDist(rng)),
-                       static_cast<Uint8>(colorDist(rng)),
-                       static_cast<Uint8>(colorDist(rng)), 255};
+      apply(tileOf(rect), rect, color, -1);
+    }
+
+    // World area of the tile an object counts towards; its aggregate
+    // changes whenever the object is added, removed or moves between tiles
+    static SDL_Rect tileArea(const SDL_Rect &rect)
+    {
+      return areaOf(tileOf(rect));
     }
 
-    void addObject(int x, int y)
+    // Returns true when the object moved to another tile
+    bool move(const SDL_Rect &from, const SDL_Rect &to, const SDL_Color &color)
     {
-      SDL_Color color = generateRandomColor();
-      objects.emplace_back(x, y, 80, 80, color);
+      int before = tileOf(from);
+      int after = tileOf(to);
+      if (before == after)
+      {
+        return false;
+      }
+      apply(before, from, color, -1);
+      apply(after, to, color, 1);
+      return true;
     }
 
-    void handleMouseDown(const SDL_MouseButtonEvent &event)
+    // For checkpoints
+    const std::vector<Tile> &tileList() const { return tiles; }
+    void restore(const Tile *data)
     {
-      int mouseX = event.x;
-      int mouseY = event.y;
+      tiles.assign(data, data + tiles.size());
+      reach.assign(tiles.size(), 0);
+      maxReach = 0;
+    }
 
-      if (event.button == SDL_BUTTON_LEFT)
+    // Calls visit(worldRect, tile) for every non-empty tile that may hold
+    // objects overlapping the area, including tiles outside it
+    template <typename Visit>
+    void forEachTile(const SDL_Rect &area, Visit &&visit) const
+    {
+      int x0 = std::clamp((area.x - maxReach) / TILE_SIZE, 0, COLUMNS - 1);
+      int y0 = std::clamp((area.y - maxReach) / TILE_SIZE, 0, ROWS - 1);
+      int x1 = std::clamp((area.x + area.w + maxReach) / TILE_SIZE, 0,
+                          COLUMNS - 1);
+      int y1 = std::clamp((area.y + area.h + maxReach) / TILE_SIZE, 0,
+                          ROWS - 1);
+      for (int ty = y0; ty <= y1; ++ty)
       {
-        // Check objects in reverse order (top to bottom)
-        for (auto it = objects.rbegin(); it != objects.rend(); ++it)
+        for (int tx = x0; tx <= x1; ++tx)
         {
-          if (it->containsPoint(mouseX, mouseY))
+          int index = ty * COLUMNS + tx;
+          const Tile &tile = tiles[index];
+          int past = reach[index];
+          if (tile.count > 0 && tx * TILE_SIZE - past < area.x + area.w &&
+              (tx + 1) * TILE_SIZE + past > area.x &&
+              ty * TILE_SIZE - past < area.y + area.h &&
+              (ty + 1) * TILE_SIZE + past > area.y)
           {
-            it->isDragging = true;
-            it->dragOffsetX = mouseX - it->rect.x;
-            it->dragOffsetY = mouseY - it->rect.y;
-
-            // Move clicked object to front
-            DraggableObject obj = *it;
-            objects.erase(std::next(it).base());
-            objects.push_back(obj);
-
-            return;
+            visit(SDL_Rect{tx * TILE_SIZE, ty * TILE_SIZE, TILE_SIZE,
+                           TILE_SIZE},
+                  tile);
           }
         }
-        // If no object was clicked, create a new one
-        addObject(mouseX, mouseY);
       }
     }
+  };
+
+  // Maps between world and window coordinates:
+  // screen = (world - origin) * zoom
+  struct Camera
+  {
+    static constexpr double MIN_ZOOM = 0.005;
+    static constexpr double MAX_ZOOM = 16.0;
+
+    double x = 0;
+    double y = 0;
+    double zoom = 1;
+
+    bool operator==(const Camera &other) const
+    {
+      return x == other.x && y == other.y && zoom == other.zoom;
+    }
+
+    SDL_Point toWorld(int screenX, int screenY) const
+    {
+      return SDL_Point{static_cast<int>(std::floor(x + screenX / zoom)),
+                       static_cast<int>(std::floor(y + screenY / zoom))};
+    }
+
+    SDL_Rect toScreen(const SDL_Rect &rect) const
+    {
+      int x0 = static_cast<int>(std::floor((rect.x - x) * zoom));
+      int y0 = static_cast<int>(std::floor((rect.y - y) * zoom));
+      int x1 = static_cast<int>(std::floor((rect.x + rect.w - x) * zoom));
+      int y1 = static_cast<int>(std::floor((rect.y + rect.h - y) * zoom));
+      return SDL_Rect{x0, y0, std::max(1, x1 - x0), std::max(1, y1 - y0)};
+    }
+
+    // World area covered by the window
+    SDL_Rect viewport() const
+    {
+      SDL_Point origin = toWorld(0, 0);
+      return SDL_Rect{origin.x, origin.y,
+                      static_cast<int>(std::ceil(WINDOW_WIDTH / zoom)) + 1,
+                      static_cast<int>(std::ceil(WINDOW_HEIGHT / zoom)) + 1};
+    }
+
+    void panBy(int screenDx, int screenDy)
+    {
+      x -= screenDx / zoom;
+      y -= screenDy / zoom;
+    }
+
+    // Zooms while keeping the world point under (screenX, screenY) fixed
+    void zoomAt(int screenX, int screenY, double factor)
+    {
+      double worldX = x + screenX / zoom;
+      double worldY = y + screenY / zoom;
+      zoom = std::clamp(zoom * factor, MIN_ZOOM, MAX_ZOOM);
+      x = worldX - screenX / zoom;
+      y = worldY - screenY / zoom;
+    }
+  };
+
+  // Fixed set of workers, each with its own task deque. A worker takes
+  // from the front of its own deque and, when that is empty, steals from
+  // the back of the others. Threads that wait on a parallelFor help run
+  // tasks instead of blocking.
+  class ThreadPool
+  {
+  private:
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    size_t queued = 0; // guarded by wakeMutex
+    bool stopping = false;
+    std::atomic<size_t> nextQueue{0};
 
-    void handleMouseUp(const SDL_MouseButtonEvent &event)
+    // Runs one task, preferring the given queue; an index past the end
+    // (a non-worker thread) only steals
+    bool runOne(size_t self)
     {
-      if (event.button == SDL_BUTTON_LEFT)
+      std::function<void()> task;
+      for (size_t k = 0; k < queues.size() && !task; ++k)
       {
-        for (auto &obj : objects)
+        size_t index = (self + k) % queues.size();
+        Queue &queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+          continue;
+        }
+        if (index == self)
+        {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        }
+        else
         {
-          obj.isDragging = false;
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
         }
       }
+      if (!task)
+      {
+        return false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        --queued;
+      }
+      task();
+      return true;
     }
 
-    void handleMouseMotion(const SDL_MouseMotionEvent &event)
+    void workerLoop(size_t self)
     {
-      for (auto &obj : objects)
+      while (true)
       {
-        obj.drag(event.x, event.y);
+        if (runOne(self))
+        {
+          continue;
+        }
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0)
+        {
+          return;
+        }
       }
     }
 
-    const std::vector<DraggableObject> &getObjects() const { return objects; }
-  };
+    void push(size_t index, std::function<void()> task)
+    {
+      {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+      }
+      {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        ++queued;
+      }
+      wake.notify_one();
+    }
 
-  ObjectManager objectManager;
-  bool running;
+  public:
+    explicit ThreadPool(size_t count)
+    {
+      for (size_t i = 0; i < count; ++i)
+      {
+        queues.push_back(std::make_unique<Queue>());
+      }
+      for (size_t i = 0; i < count; ++i)
+      {
+        workers.emplace_back([this, i] { workerLoop(i); });
+      }
+    }
 
-public:
-  SDLApp() : running(true)
-  {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    ~ThreadPool()
     {
-      throw std::runtime_error(std::string("SDL initialization failed: ") +
-                               SDL_GetError());
+      {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      for (std::thread &worker : workers)
+      {
+        worker.join();
+      }
     }
 
-    window.reset(SDL_CreateWindow("Multiple Draggable Objects Demo",
-                                  SDL_WINDOWPOS_UNDEFINED,
-                                  SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH,
-                                  WINDOW_HEIGHT, SDL_WINDOW_SHOWN));
+    size_t size() const { return workers.size(); }
 
-    if (!window)
+    // Queues a task to run in the background
+    void submit(std::function<void()> task)
     {
-      throw std::runtime_error(std::string("Window creation failed: ") +
-                               SDL_GetError());
+      if (queues.empty())
+      {
+        task();
+        return;
+      }
+      push(nextQueue++ % queues.size(), std::move(task));
+    }
+
+    // Runs body(i) for every i in [0, count) and returns when all are done.
+    // Indices are dealt round-robin to the worker deques, so neighbouring
+    // (similarly expensive) items start on different workers.
+    template <typename Body> void parallelFor(size_t count, Body &&body)
+    {
+      if (queues.empty())
+      {
+        for (size_t i = 0; i < count; ++i)
+        {
+          body(i);
+        }
+        return;
+      }
+      std::atomic<size_t> done{0};
+      for (size_t i = 0; i < count; ++i)
+      {
+        push(i % queues.size(), [&body, &done, i] {
+          body(i);
+          done.fetch_add(1, std::memory_order_release);
+        });
+      }
+      while (done.load(std::memory_order_acquire) < count)
+      {
+        if (!runOne(queues.size()))
+        {
+          std::this_thread::yield();
+        }
+      }
     }
+  };
+
+  // Destination for the draw calls of a frame. Colors are opaque
+  // unless noted; drawRects outlines, fillRects fills.
+  class RenderBackend
+  {
+  public:
+    virtual ~RenderBackend() = default;
+    virtual const char *name() const = 0;
+    virtual void clear(SDL_Color color) = 0;
+    virtual void fillRects(const SDL_Rect *rects, int count,
+                           SDL_Color color) = 0;
+    virtual void drawRects(const SDL_Rect *rects, int count,
+                           SDL_Color color) = 0;
+    virtual void present() = 0;
 
-    renderer.reset(
-        SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED));
+    // An object: a filled rect with a one-pixel border. Backends without
+    // sprite support draw it with primitives.
+    virtual void drawSprite(const SDL_Rect &rect, SDL_Color fill,
+                            SDL_Color border)
+    {
+      fillRects(&rect, 1, fill);
+      drawRects(&rect, 1, border);
+    }
 
-    if (!renderer)
+    // An image object; backends without textures show its average color
+    virtual void drawImage(const SDL_Rect &rect, Uint32, SDL_Color average)
     {
-      throw std::runtime_error(std::string("Renderer creation failed: ") +
-                               SDL_GetError());
+      fillRects(&rect, 1, average);
     }
-  }
 
-  ~SDLApp() { SDL_Quit(); }
+    // Draws the following frames into the top left scale x scale part of a
+    // window-sized target, stretched over the window on present. Returns
+    // false if the backend cannot scale.
+    virtual bool setResolutionScale(double scale) { return scale == 1.0; }
 
-  void handleEvents()
+    // Limits the next frame to these areas of the target, keeping the
+    // previous pixels elsewhere; nullptr means all of it. Backends that always
+    // redraw everything ignore it.
+    virtual void setDamage(const std::vector<SDL_Rect> *) {}
+
+    // Window pixels sent to the display by the last present()
+    virtual size_t presentedPixels() const
+    {
+      return static_cast<size_t>(WINDOW_WIDTH) * WINDOW_HEIGHT;
+    }
+  };
+
+  // Halves a square ARGB level with a 2x2 box filter. SSE2 averages two
+  // output pixels per step from four pixels of each source row.
+  static void downsampleLevel(const Uint32 *src, int size, Uint32 *dst)
   {
-    SDL_Event event;
-    while (SDL_PollEvent(&event))
+    int half = size / 2;
+    for (int y = 0; y < half; ++y)
     {
-      switch (event.type)
+      const Uint32 *row0 = src + static_cast<size_t>(2 * y) * size;
+      const Uint32 *row1 = row0 + size;
+      Uint32 *out = dst + static_cast<size_t>(y) * half;
+      int x = 0;
+#if defined(__SSE2__)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i round = _mm_set1_epi16(2);
+      for (; x + 2 <= half; x += 2)
       {
-      case SDL_QUIT:
-        running = false;
-        break;
-      case SDL_MOUSEBUTTONDOWN:
-        objectManager.handleMouseDown(event.button);
-        break;
-      case SDL_MOUSEBUTTONUP:
-        objectManager.handleMouseUp(event.button);
-        break;
-      case SDL_MOUSEMOTION:
-        objectManager.handleMouseMotion(event.motion);
-        break;
-      case SDL_KEYDOWN:
-        if (event.key.keysym.sym == SDLK_ESCAPE)
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x));
+        // Vertical sums of pixel pairs, as 16-bit channels
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                   _mm_unpacklo_epi8(b, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                   _mm_unpackhi_epi8(b, zero));
+        // Add each pair's right column to its left one
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+        __m128i sum = _mm_unpacklo_epi64(lo, hi);
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x),
+                         _mm_packus_epi16(sum, zero));
+      }
+#endif
+      for (; x < half; ++x)
+      {
+        Uint32 p[4] = {row0[2 * x], row0[2 * x + 1], row1[2 * x],
+                       row1[2 * x + 1]};
+        Uint32 pixel = 0;
+        for (int shift = 0; shift < 32; shift += 8)
         {
-          running = false;
+          Uint32 sum = 2;
+          for (Uint32 q : p)
+          {
+            sum += (q >> shift) & 0xff;
+          }
+          pixel |= (sum >> 2) << shift;
         }
-        break;
+        out[x] = pixel;
       }
     }
   }
 
-  void render()
+  // BMP images shown by image objects, as mip pyramids from BASE_SIZE down
+  // to 1x1. Decoding and filtering run on the loader's own workers, so
+  // slow disks never hold up the render pool; the event/render thread only
+  // queues paths, collects finished images in poll() and uploads level
+  // textures as they are drawn.
+  //
+  // Levels up to RESIDENT_SIZE stay loaded for good. Finer ones count
+  // against the memory budget and are dropped for the least recently drawn
+  // images when it is exceeded, then decoded again when next needed.
+  class ImageLoader
   {
-    // Clear screen
-    SDL_SetRenderDrawColor(renderer.get(), 240, 240, 240, 255);
-    SDL_RenderClear(renderer.get());
+  public:
+    static constexpr int OBJECT_SIZE = 80; // world size of image objects
+    static constexpr int BASE_SIZE = 256;
+    static constexpr int RESIDENT_SIZE = 64;
 
-    // Draw all objects
-    for (const auto &obj : objectManager.getObjects())
+    struct Level
     {
-      SDL_SetRenderDrawColor(renderer.get(), obj.color.r, obj.color.g,
-                             obj.color.b, obj.color.a);
-      SDL_RenderFillRect(renderer.get(), &obj.rect);
+      int size;
+      std::vector<Uint32> pixels; // ARGB, freed once uploaded
+      std::unique_ptr<SDL_Texture, SDL_Deleter> texture;
 
-      // Draw border
-      SDL_SetRenderDrawColor(renderer.get(), 0, 0, 0, 255);
-      SDL_RenderDrawRect(renderer.get(), &obj.rect);
+      bool resident() const { return texture || !pixels.empty(); }
+      size_t bytes() const { return size_t(size) * size * sizeof(Uint32); }
+    };
+
+    struct Image
+    {
+      std::string path;
+      bool ready = false;  // decoded and collected by poll()
+      bool failed = false; // written by the worker before it reports
+      SDL_Color average{0, 0, 0, 255};
+      std::vector<Level> levels; // finest first
+      bool fineResident = false;
+      bool reloading = false;
+      Uint64 lastDrawn = 0;
+      std::list<Uint32>::iterator lruPosition;
+    };
+
+  private:
+    // A decode in flight. Tasks may outlive a poll() or the loader, so
+    // they only touch this.
+    struct Job
+    {
+      Uint32 id;
+      std::string path;
+      bool failed = false;
+      std::vector<Level> levels;
+    };
+
+    struct Finished
+    {
+      std::mutex mutex;
+      std::vector<std::shared_ptr<Job>> jobs;
+      std::atomic<bool> cancelled{false};
+    };
+
+    std::vector<std::shared_ptr<Image>> images; // by id - 1
+    std::shared_ptr<Finished> finished = std::make_shared<Finished>();
+    size_t pending = 0;
+    size_t budget;
+    size_t fineBytes = 0;
+    std::list<Uint32> fineLru; // most recently drawn first
+    Uint64 frame = 0;
+    ThreadPool workers; // last, so it is joined before the rest goes
+
+    static bool isFine(const Level &level) { return level.size > RESIDENT_SIZE; }
+
+    static size_t fineSize(const Image &image)
+    {
+      size_t bytes = 0;
+      for (const Level &level : image.levels)
+      {
+        bytes += isFine(level) ? level.bytes() : 0;
+      }
+      return bytes;
     }
 
-    SDL_RenderPresent(renderer.get());
-  }
+    // Box-filters the BMP to BASE_SIZE, then halves it down to 1x1
+    static void decode(Job &job)
+    {
+      SDL_Surface *loaded = SDL_LoadBMP(job.path.c_str());
+      SDL_Surface *surface =
+          loaded ? SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_ARGB8888, 0)
+                 : nullptr;
+      SDL_FreeSurface(loaded);
+      if (!surface || surface->w <= 0 || surface->h <= 0)
+      {
+        SDL_FreeSurface(surface);
+        job.failed = true;
+        return;
+      }
 
-  void run()
-  {
-    while (running)
+      job.levels.push_back(Level{BASE_SIZE, {}, nullptr});
+      std::vector<Uint32> &base = job.levels.back().pixels;
+      base.resize(static_cast<size_t>(BASE_SIZE) * BASE_SIZE);
+      for (int ty = 0; ty < BASE_SIZE; ++ty)
+      {
+        int y0 = ty * surface->h / BASE_SIZE;
+        int y1 = std::max(y0 + 1, (ty + 1) * surface->h / BASE_SIZE);
+        for (int tx = 0; tx < BASE_SIZE; ++tx)
+        {
+          int x0 = tx * surface->w / BASE_SIZE;
+          int x1 = std::max(x0 + 1, (tx + 1) * surface->w / BASE_SIZE);
+          Uint32 sum[3] = {};
+          for (int y = y0; y < y1; ++y)
+          {
+            const Uint32 *row = reinterpret_cast<const Uint32 *>(
+                static_cast<const Uint8 *>(surface->pixels) +
+                static_cast<size_t>(y) * surface->pitch);
+            for (int x = x0; x < x1; ++x)
+            {
+              sum[0] += (row[x] >> 16) & 0xff;
+              sum[1] += (row[x] >> 8) & 0xff;
+              sum[2] += row[x] & 0xff;
+            }
+          }
+          Uint32 count = static_cast<Uint32>((y1 - y0) * (x1 - x0));
+          base[static_cast<size_t>(ty) * BASE_SIZE + tx] =
+              0xff000000u | ((sum[0] / count) << 16) |
+              ((sum[1] / count) << 8) | (sum[2] / count);
+        }
+      }
+      SDL_FreeSurface(surface);
+
+      for (int size = BASE_SIZE / 2; size >= 1; size /= 2)
+      {
+        Level level{size, {}, nullptr};
+        level.pixels.resize(static_cast<size_t>(size) * size);
+        downsampleLevel(job.levels.back().pixels.data(), size * 2,
+                        level.pixels.data());
+        job.levels.push_back(std::move(level));
+      }
+    }
+
+    void submit(Uint32 id)
     {
-      handleEvents();
+      auto job = std::make_shared<Job>();
+      job->id = id;
+      job->path = images[id - 1]->path;
+      ++pending;
+      std::shared_ptr<Finished> done = finished;
+      workers.submit([job, done] {
+        if (done->cancelled)
+        {
+          return;
+        }
+        decode(*job);
+        std::lock_guard<std::mutex> lock(done->mutex);
+        done->jobs.push_back(job);
+      });
+    }
+
+    void dropFine(Image &image)
+    {
+      for (Level &level : image.levels)
+      {
+        if (isFine(level))
+        {
+          level.pixels = std::vector<Uint32>();
+          level.texture.reset();
+        }
+      }
+      fineBytes -= fineSize(image);
+      fineLru.erase(image.lruPosition);
+      image.fineResident = false;
+    }
+
+    // Evicts fine levels of images not drawn this frame, oldest first
+    void trim()
+    {
+      while (fineBytes > budget && !fineLru.empty())
+      {
+        Image &oldest = *images[fineLru.back() - 1];
+        if (oldest.lastDrawn == frame)
+        {
+          break;
+        }
+        dropFine(oldest);
+      }
+    }
+
+  public:
+    ImageLoader(size_t threads, size_t budgetBytes)
+        : budget(budgetBytes), workers(std::max<size_t>(threads, 1))
+    {
+    }
+
+    ~ImageLoader() { finished->cancelled = true; }
+
+    // Queues a BMP for decoding and returns its image id (never 0)
+    Uint32 load(const std::string &path)
+    {
+      auto image = std::make_shared<Image>();
+      image->path = path;
+      images.push_back(image);
+      Uint32 id = static_cast<Uint32>(images.size());
+      submit(id);
+      return id;
+    }
+
+    // Collects images decoded since the last call, evicts over budget and
+    // returns how many images became ready to draw. Called once per frame.
+    size_t poll()
+    {
+      std::vector<std::shared_ptr<Job>> jobs;
+      {
+        std::lock_guard<std::mutex> lock(finished->mutex);
+        jobs.swap(finished->jobs);
+      }
+      size_t ready = 0;
+      for (std::shared_ptr<Job> &job : jobs)
+      {
+        Image &image = *images[job->id - 1];
+        --pending;
+        image.reloading = false;
+        if (job->failed)
+        {
+          image.failed = true;
+          std::cerr << "Could not load image: " << image.path << std::endl;
+          continue;
+        }
+        if (!image.ready)
+        {
+          const std::vector<Uint32> &last = job->levels.back().pixels;
+          image.average = SDL_Color{Uint8(last[0] >> 16), Uint8(last[0] >> 8),
+                                    Uint8(last[0]), 255};
+          image.levels = std::move(job->levels);
+          image.ready = true;
+          ++ready;
+        }
+        else if (!image.fineResident)
+        {
+          // A reload: only the fine levels were missing
+          for (size_t i = 0; i < image.levels.size(); ++i)
+          {
+            if (isFine(image.levels[i]))
+            {
+              image.levels[i].pixels = std::move(job->levels[i].pixels);
+            }
+          }
+        }
+        else
+        {
+          continue;
+        }
+        image.fineResident = true;
+        fineBytes += fineSize(image);
+        fineLru.push_front(job->id);
+        image.lruPosition = fineLru.begin();
+      }
+      trim();
+      ++frame;
+      return ready;
+    }
+
+    bool isReady(Uint32 id) const
+    {
+      return id <= images.size() && images[id - 1]->ready;
+    }
+
+    const Image &get(Uint32 id) const { return *images[id - 1]; }
+
+    // Paths of all images, by id - 1
+    std::vector<std::string> paths() const
+    {
+      std::vector<std::string> out;
+      out.reserve(images.size());
+      for (const std::shared_ptr<Image> &image : images)
+      {
+        out.push_back(image->path);
+      }
+      return out;
+    }
+
+    size_t pendingCount() const { return pending; }
+
+    // Destroys every uploaded texture, for shutting SDL down while the
+    // loader still exists; nothing may be drawn afterwards
+    void releaseTextures()
+    {
+      for (const std::shared_ptr<Image> &image : images)
+      {
+        for (Level &level : image->levels)
+        {
+          level.texture.reset();
+        }
+      }
+    }
+
+    // The texture of the level matching a draw of the given size: the
+    // smallest level at least that large. A missing fine level is queued
+    // for reloading and the finest resident one used meanwhile. Creating a
+    // texture takes one of uploadsLeft.
+    SDL_Texture *texture(SDL_Renderer *renderer, Uint32 id, int pixels,
+                         int &uploadsLeft)
+    {
+      Image &image = *images[id - 1];
+      if (!image.ready)
+      {
+        return nullptr;
+      }
+      size_t want = 0;
+      while (want + 1 < image.levels.size() &&
+             image.levels[want + 1].size >= pixels)
+      {
+        ++want;
+      }
+      if (isFine(image.levels[want]))
+      {
+        if (image.fineResident)
+        {
+          image.lastDrawn = frame;
+          fineLru.splice(fineLru.begin(), fineLru, image.lruPosition);
+        }
+        else if (!image.reloading)
+        {
+          image.reloading = true;
+          submit(id);
+        }
+      }
+      for (size_t i = want; i < image.levels.size(); ++i)
+      {
+        Level &level = image.levels[i];
+        if (level.texture)
+        {
+          return level.texture.get();
+        }
+        if (level.pixels.empty() || uploadsLeft <= 0)
+        {
+          continue;
+        }
+        level.texture.reset(
+            SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                              SDL_TEXTUREACCESS_STATIC, level.size,
+                              level.size));
+        if (!level.texture)
+        {
+          continue;
+        }
+        --uploadsLeft;
+        SDL_UpdateTexture(level.texture.get(), nullptr, level.pixels.data(),
+                          level.size * static_cast<int>(sizeof(Uint32)));
+        SDL_SetTextureScaleMode(level.texture.get(), SDL_ScaleModeLinear);
+        level.pixels = std::vector<Uint32>();
+        return level.texture.get();
+      }
+      return nullptr;
+    }
+  };
+
+  // A distinct object image: its size plus ARGB fill and border colors
+  struct SpriteKey
+  {
+    int w, h;
+    Uint32 fill, border;
+
+    bool operator==(const SpriteKey &other) const
+    {
+      return w == other.w && h == other.h && fill == other.fill &&
+             border == other.border;
+    }
+  };
+
+  struct SpriteKeyHash
+  {
+    size_t operator()(const SpriteKey &key) const
+    {
+      Uint64 a = (Uint64(Uint32(key.w)) << 32) | Uint32(key.h);
+      Uint64 b = (Uint64(key.fill) << 32) | key.border;
+      return std::hash<Uint64>()(a * 0x9e3779b97f4a7c15ull ^ b);
+    }
+  };
+
+  struct SpriteCounters
+  {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+    size_t bytes = 0;
+    size_t textures = 0;
+    size_t repacks = 0;
+  };
+
+  static SpriteKey spriteKey(const SDL_Rect &rect, SDL_Color fill,
+                             SDL_Color border)
+  {
+    auto argb = [](SDL_Color c)
+    {
+      return (Uint32(c.a) << 24) | (Uint32(c.r) << 16) | (Uint32(c.g) << 8) |
+             c.b;
+    };
+    return SpriteKey{rect.w, rect.h, argb(fill), argb(border)};
+  }
+
+  // Writes the sprite's pixels to dst, whose rows are pitch pixels apart
+  static void bakeSprite(const SpriteKey &key, Uint32 *dst, int pitch)
+  {
+    for (int y = 0; y < key.h; ++y)
+    {
+      Uint32 *row = dst + static_cast<size_t>(y) * pitch;
+      bool edge = y == 0 || y == key.h - 1;
+      std::fill_n(row, key.w, edge ? key.border : key.fill);
+      row[0] = key.border;
+      row[key.w - 1] = key.border;
+    }
+  }
+
+  // Object images baked into textures once per distinct (size, fill,
+  // border), so an object is a single SDL_RenderCopy. The least recently
+  // used textures are destroyed when their total size exceeds the budget.
+  class SpriteCache
+  {
+  private:
+    struct Entry
+    {
+      SpriteKey key;
+      std::unique_ptr<SDL_Texture, SDL_Deleter> texture;
+      size_t bytes;
+    };
+
+    SDL_Renderer *renderer;
+    size_t budget;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<SpriteKey, std::list<Entry>::iterator, SpriteKeyHash>
+        index;
+    std::vector<Uint32> scratch;
+    SpriteCounters counters;
+
+    SDL_Texture *bake(const SpriteKey &key)
+    {
+      scratch.resize(static_cast<size_t>(key.w) * key.h);
+      bakeSprite(key, scratch.data(), key.w);
+      SDL_Texture *texture =
+          SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                            SDL_TEXTUREACCESS_STATIC, key.w, key.h);
+      if (texture)
+      {
+        SDL_UpdateTexture(texture, nullptr, scratch.data(),
+                          key.w * static_cast<int>(sizeof(Uint32)));
+      }
+      return texture;
+    }
+
+  public:
+    SpriteCache(SDL_Renderer *r, size_t budgetBytes)
+        : renderer(r), budget(budgetBytes)
+    {
+    }
+
+    // Returns the texture for the sprite, or nullptr when it is too large
+    // to be worth caching (or could not be created)
+    SDL_Texture *get(const SDL_Rect &rect, SDL_Color fill, SDL_Color border)
+    {
+      SpriteKey key = spriteKey(rect, fill, border);
+      auto found = index.find(key);
+      if (found != index.end())
+      {
+        ++counters.hits;
+        lru.splice(lru.begin(), lru, found->second);
+        return found->second->texture.get();
+      }
+
+      ++counters.misses;
+      size_t bytes = static_cast<size_t>(rect.w) * rect.h * sizeof(Uint32);
+      if (bytes > budget / 4)
+      {
+        return nullptr;
+      }
+      SDL_Texture *texture = bake(key);
+      if (!texture)
+      {
+        return nullptr;
+      }
+      lru.push_front(Entry{key, {texture, SDL_Deleter()}, bytes});
+      index[key] = lru.begin();
+      counters.bytes += bytes;
+      while (counters.bytes > budget)
+      {
+        counters.bytes -= lru.back().bytes;
+        index.erase(lru.back().key);
+        lru.pop_back();
+        ++counters.evictions;
+      }
+      counters.textures = lru.size();
+      return texture;
+    }
+
+    const SpriteCounters &getCounters() const { return counters; }
+  };
+
+  // Object images shelf-packed into a few large atlas pages, so a run of
+  // sprites from one page is a single SDL_RenderGeometry call. Evicting an
+  // image leaves a hole; once a page's holes pass REPACK_THRESHOLD of its
+  // used area the page is compacted on the atlas's own worker and swapped
+  // in at the end of a later frame. Not on the render pool: a parallelFor
+  // there could pick the repack up and run it inside a frame. A page is
+  // frozen while it is being repacked.
+  class SpriteAtlas
+  {
+  public:
+    static constexpr int PAGE_SIZE = 2048;
+    static constexpr int MAX_SPRITE = 256; // larger sprites are not packed
+    static constexpr double REPACK_THRESHOLD = 0.3;
+
+  private:
+    struct Shelf
+    {
+      int y, h, x;
+    };
+
+    struct Layout
+    {
+      std::vector<Shelf> shelves;
+      int bottom = 0;
+    };
+
+    struct Page
+    {
+      std::unique_ptr<SDL_Texture, SDL_Deleter> texture;
+      // CPU copy of the texture, read by the repack job
+      std::shared_ptr<std::vector<Uint32>> pixels;
+      Layout layout;
+      size_t livePixels = 0;
+      size_t deadPixels = 0;
+      bool repacking = false;
+    };
+
+    struct Entry
+    {
+      SpriteKey key;
+      int page;
+      SDL_Rect rect;
+      Uint64 lastUsed;
+    };
+
+    // Compaction of one page. The worker only touches the job, so the
+    // atlas can keep drawing from the old page meanwhile.
+    struct Repack
+    {
+      int page;
+      std::vector<std::pair<SpriteKey, SDL_Rect>> entries; // new rects out
+      std::vector<bool> placed;
+      std::shared_ptr<const std::vector<Uint32>> source;
+      std::shared_ptr<std::vector<Uint32>> pixels;
+      Layout layout;
+      std::atomic<bool> done{false};
+    };
+
+    SDL_Renderer *renderer;
+    size_t maxPages;
+    std::vector<Page> pages;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<SpriteKey, std::list<Entry>::iterator, SpriteKeyHash>
+        index;
+    std::shared_ptr<Repack> repack; // at most one in flight
+    std::vector<Uint32> scratch;
+    Uint64 frame = 0;
+    SpriteCounters counters;
+    ThreadPool repacker{1}; // last, so it is joined before the rest goes
+
+    // Shelves are rounded up to 8 rows and reused by sprites up to twice
+    // shorter; a one-pixel gap keeps neighbours apart
+    static bool place(Layout &layout, int w, int h, SDL_Rect &out)
+    {
+      int cellW = w + 1;
+      int cellH = ((h + 1) + 7) & ~7;
+      Shelf *best = nullptr;
+      for (Shelf &shelf : layout.shelves)
+      {
+        if (shelf.h >= h + 1 && shelf.h <= cellH * 2 &&
+            shelf.x + cellW <= PAGE_SIZE && (!best || shelf.h < best->h))
+        {
+          best = &shelf;
+        }
+      }
+      if (!best)
+      {
+        if (layout.bottom + cellH > PAGE_SIZE)
+        {
+          return false;
+        }
+        layout.shelves.push_back(Shelf{layout.bottom, cellH, 0});
+        layout.bottom += cellH;
+        best = &layout.shelves.back();
+      }
+      out = SDL_Rect{best->x, best->y, w, h};
+      best->x += cellW;
+      return true;
+    }
+
+    static void runRepack(Repack &job)
+    {
+      // Tallest first keeps shelves full
+      std::vector<size_t> order(job.entries.size());
+      for (size_t i = 0; i < order.size(); ++i)
+      {
+        order[i] = i;
+      }
+      std::sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                { return job.entries[a].second.h > job.entries[b].second.h; });
+
+      job.pixels = std::make_shared<std::vector<Uint32>>(
+          static_cast<size_t>(PAGE_SIZE) * PAGE_SIZE, 0);
+      job.placed.assign(job.entries.size(), false);
+      for (size_t i : order)
+      {
+        SDL_Rect from = job.entries[i].second;
+        SDL_Rect to;
+        if (!place(job.layout, from.w, from.h, to))
+        {
+          continue;
+        }
+        for (int y = 0; y < from.h; ++y)
+        {
+          std::copy_n(job.source->data() +
+                          static_cast<size_t>(from.y + y) * PAGE_SIZE + from.x,
+                      from.w,
+                      job.pixels->data() +
+                          static_cast<size_t>(to.y + y) * PAGE_SIZE + to.x);
+        }
+        job.entries[i].second = to;
+        job.placed[i] = true;
+      }
+      job.done.store(true, std::memory_order_release);
+    }
+
+    bool addPage()
+    {
+      if (pages.size() >= maxPages)
+      {
+        return false;
+      }
+      SDL_Texture *texture =
+          SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                            SDL_TEXTUREACCESS_STATIC, PAGE_SIZE, PAGE_SIZE);
+      if (!texture)
+      {
+        return false;
+      }
+      pages.emplace_back();
+      pages.back().texture.reset(texture);
+      pages.back().pixels = std::make_shared<std::vector<Uint32>>(
+          static_cast<size_t>(PAGE_SIZE) * PAGE_SIZE, 0);
+      counters.bytes = pages.size() * PAGE_SIZE * PAGE_SIZE * sizeof(Uint32);
+      return true;
+    }
+
+    void evict(std::list<Entry>::iterator entry)
+    {
+      Page &page = pages[entry->page];
+      size_t area = static_cast<size_t>(entry->rect.w) * entry->rect.h;
+      page.livePixels -= area;
+      page.deadPixels += area;
+      if (page.livePixels == 0 && !page.repacking)
+      {
+        // Nothing left to keep, so the whole page is free again
+        page.layout = Layout();
+        page.deadPixels = 0;
+      }
+      index.erase(entry->key);
+      lru.erase(entry);
+      ++counters.evictions;
+    }
+
+    // Frees images not drawn this frame, oldest first. Only empties pages
+    // outright or feeds the next repack, as shelves never reuse holes.
+    void evictStale()
+    {
+      size_t budget = lru.size() / 4 + 1;
+      while (budget-- > 0 && !lru.empty() && lru.back().lastUsed < frame)
+      {
+        evict(std::prev(lru.end()));
+      }
+    }
+
+    int allocate(int w, int h, SDL_Rect &out)
+    {
+      for (int attempt = 0; attempt < 2; ++attempt)
+      {
+        for (size_t p = 0; p < pages.size(); ++p)
+        {
+          if (!pages[p].repacking && place(pages[p].layout, w, h, out))
+          {
+            return static_cast<int>(p);
+          }
+        }
+        if (addPage() && place(pages.back().layout, w, h, out))
+        {
+          return static_cast<int>(pages.size() - 1);
+        }
+        evictStale();
+      }
+      return -1;
+    }
+
+    void install(Repack &job)
+    {
+      Page &page = pages[job.page];
+      size_t live = 0;
+      size_t dead = 0;
+      std::vector<SpriteKey> dropped;
+      for (size_t i = 0; i < job.entries.size(); ++i)
+      {
+        const SDL_Rect &rect = job.entries[i].second;
+        size_t area = static_cast<size_t>(rect.w) * rect.h;
+        auto found = index.find(job.entries[i].first);
+        bool current = found != index.end() && found->second->page == job.page;
+        if (current && job.placed[i])
+        {
+          found->second->rect = rect;
+          live += area;
+        }
+        else if (current)
+        {
+          live += area;
+          dropped.push_back(job.entries[i].first);
+        }
+        else if (job.placed[i])
+        {
+          dead += area; // evicted while the job ran
+        }
+      }
+      page.pixels = job.pixels;
+      page.layout = std::move(job.layout);
+      page.livePixels = live;
+      page.deadPixels = dead;
+      page.repacking = false;
+      for (const SpriteKey &key : dropped)
+      {
+        evict(index[key]);
+      }
+      SDL_UpdateTexture(page.texture.get(), nullptr, page.pixels->data(),
+                        PAGE_SIZE * static_cast<int>(sizeof(Uint32)));
+      ++counters.repacks;
+    }
+
+    void startRepack()
+    {
+      for (size_t p = 0; p < pages.size(); ++p)
+      {
+        Page &page = pages[p];
+        size_t used = page.livePixels + page.deadPixels;
+        if (page.deadPixels == 0 || page.deadPixels < used * REPACK_THRESHOLD)
+        {
+          continue;
+        }
+        repack = std::make_shared<Repack>();
+        repack->page = static_cast<int>(p);
+        repack->source = page.pixels;
+        for (const Entry &entry : lru)
+        {
+          if (entry.page == repack->page)
+          {
+            repack->entries.emplace_back(entry.key, entry.rect);
+          }
+        }
+        page.repacking = true;
+        std::shared_ptr<Repack> job = repack;
+        repacker.submit([job] { runRepack(*job); });
+        return;
+      }
+    }
+
+  public:
+    SpriteAtlas(SDL_Renderer *r, size_t budgetBytes)
+        : renderer(r),
+          maxPages(std::max<size_t>(
+              1, budgetBytes / (static_cast<size_t>(PAGE_SIZE) * PAGE_SIZE *
+                                sizeof(Uint32))))
+    {
+    }
+
+    // Finds or packs the sprite. Returns false when it is too large for
+    // the atlas or no page has room this frame.
+    bool get(const SDL_Rect &rect, SDL_Color fill, SDL_Color border,
+             int &page, SDL_Rect &source)
+    {
+      SpriteKey key = spriteKey(rect, fill, border);
+      auto found = index.find(key);
+      if (found != index.end())
+      {
+        ++counters.hits;
+        lru.splice(lru.begin(), lru, found->second);
+        found->second->lastUsed = frame;
+        page = found->second->page;
+        source = found->second->rect;
+        return true;
+      }
+
+      ++counters.misses;
+      if (rect.w > MAX_SPRITE || rect.h > MAX_SPRITE)
+      {
+        return false;
+      }
+      page = allocate(key.w, key.h, source);
+      if (page < 0)
+      {
+        return false;
+      }
+      Page &target = pages[page];
+      scratch.resize(static_cast<size_t>(key.w) * key.h);
+      bakeSprite(key, scratch.data(), key.w);
+      SDL_UpdateTexture(target.texture.get(), &source, scratch.data(),
+                        key.w * static_cast<int>(sizeof(Uint32)));
+      for (int y = 0; y < key.h; ++y)
+      {
+        std::copy_n(scratch.data() + static_cast<size_t>(y) * key.w, key.w,
+                    target.pixels->data() +
+                        static_cast<size_t>(source.y + y) * PAGE_SIZE +
+                        source.x);
+      }
+      target.livePixels += static_cast<size_t>(key.w) * key.h;
+      lru.push_front(Entry{key, page, source, frame});
+      index[key] = lru.begin();
+      counters.textures = lru.size();
+      return true;
+    }
+
+    SDL_Texture *texture(int page) const { return pages[page].texture.get(); }
+
+    // Call once per frame after the last draw: swaps in a finished repack
+    // and starts the next one if a page is fragmented enough
+    void endFrame()
+    {
+      if (repack && repack->done.load(std::memory_order_acquire))
+      {
+        install(*repack);
+        repack.reset();
+      }
+      if (!repack)
+      {
+        startRepack();
+      }
+      counters.textures = lru.size();
+      ++frame;
+    }
+
+    const SpriteCounters &getCounters() const { return counters; }
+  };
+
+  // Draws through SDL_Renderer primitives, or with baked sprite textures
+  // once enableSprites() or enableAtlas() is called. Atlas sprites are
+  // queued and drawn with one SDL_RenderGeometry per run from the same
+  // page; any other draw flushes the queue first to keep the order.
+  class SdlBackend : public RenderBackend
+  {
+  private:
+    SDL_Renderer *renderer;
+    std::unique_ptr<SpriteCache> sprites;
+    std::unique_ptr<SpriteAtlas> atlas;
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+    int batchPage = -1;
+    ImageLoader *images = nullptr;
+    // Offscreen target while drawing below window resolution
+    std::unique_ptr<SDL_Texture, SDL_Deleter> target;
+    SDL_Rect targetArea{0, 0, 0, 0};
+    // Image textures created per frame, so a burst of newly decoded images
+    // spreads its uploads over several frames
+    static constexpr int MAX_IMAGE_UPLOADS = 64;
+    int imageUploadsLeft = MAX_IMAGE_UPLOADS;
+
+    void flushSprites()
+    {
+      if (vertices.empty())
+      {
+        return;
+      }
+      SDL_RenderGeometry(renderer, atlas->texture(batchPage), vertices.data(),
+                         static_cast<int>(vertices.size()), indices.data(),
+                         static_cast<int>(indices.size()));
+      vertices.clear();
+      indices.clear();
+    }
+
+    void queueQuad(const SDL_Rect &rect, const SDL_Rect &source)
+    {
+      const float scale = 1.0f / SpriteAtlas::PAGE_SIZE;
+      float x0 = static_cast<float>(rect.x);
+      float y0 = static_cast<float>(rect.y);
+      float x1 = static_cast<float>(rect.x + rect.w);
+      float y1 = static_cast<float>(rect.y + rect.h);
+      float u0 = source.x * scale;
+      float v0 = source.y * scale;
+      float u1 = (source.x + source.w) * scale;
+      float v1 = (source.y + source.h) * scale;
+      SDL_Color white{255, 255, 255, 255};
+      int base = static_cast<int>(vertices.size());
+      vertices.push_back(SDL_Vertex{{x0, y0}, white, {u0, v0}});
+      vertices.push_back(SDL_Vertex{{x1, y0}, white, {u1, v0}});
+      vertices.push_back(SDL_Vertex{{x0, y1}, white, {u0, v1}});
+      vertices.push_back(SDL_Vertex{{x1, y1}, white, {u1, v1}});
+      for (int offset : {0, 1, 2, 2, 1, 3})
+      {
+        indices.push_back(base + offset);
+      }
+    }
+
+  public:
+    explicit SdlBackend(SDL_Renderer *r) : renderer(r) {}
+
+    void enableSprites(size_t budgetBytes)
+    {
+      sprites = std::make_unique<SpriteCache>(renderer, budgetBytes);
+    }
+
+    void enableAtlas(size_t budgetBytes)
+    {
+      atlas = std::make_unique<SpriteAtlas>(renderer, budgetBytes);
+    }
+
+    void setImages(ImageLoader *loader) { images = loader; }
+
+    bool setResolutionScale(double scale) override
+    {
+      if (scale >= 1.0)
+      {
+        target.reset();
+        return true;
+      }
+      int w = 0;
+      int h = 0;
+      SDL_GetRendererOutputSize(renderer, &w, &h);
+      if (!target)
+      {
+        target.reset(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                       SDL_TEXTUREACCESS_TARGET, w, h));
+        if (!target)
+        {
+          return false;
+        }
+        SDL_SetTextureScaleMode(target.get(), SDL_ScaleModeLinear);
+      }
+      targetArea = SDL_Rect{0, 0, std::max(1, int(std::ceil(w * scale))),
+                            std::max(1, int(std::ceil(h * scale)))};
+      return true;
+    }
+
+    void drawImage(const SDL_Rect &rect, Uint32 image,
+                   SDL_Color average) override
+    {
+      flushSprites();
+      SDL_Texture *texture =
+          images ? images->texture(renderer, image, std::max(rect.w, rect.h),
+                                   imageUploadsLeft)
+                 : nullptr;
+      if (!texture)
+      {
+        RenderBackend::drawImage(rect, image, average);
+        return;
+      }
+      SDL_RenderCopy(renderer, texture, nullptr, &rect);
+    }
+
+    const SpriteCounters *spriteCounters() const
+    {
+      if (atlas)
+      {
+        return &atlas->getCounters();
+      }
+      return sprites ? &sprites->getCounters() : nullptr;
+    }
+
+    void drawSprite(const SDL_Rect &rect, SDL_Color fill,
+                    SDL_Color border) override
+    {
+      int page;
+      SDL_Rect source;
+      if (atlas && atlas->get(rect, fill, border, page, source))
+      {
+        if (page != batchPage)
+        {
+          flushSprites();
+          batchPage = page;
+        }
+        queueQuad(rect, source);
+        return;
+      }
+      SDL_Texture *texture = sprites ? sprites->get(rect, fill, border) : nullptr;
+      if (texture)
+      {
+        SDL_RenderCopy(renderer, texture, nullptr, &rect);
+      }
+      else
+      {
+        RenderBackend::drawSprite(rect, fill, border);
+      }
+    }
+
+    const char *name() const override { return "sdl"; }
+
+    void clear(SDL_Color color) override
+    {
+      flushSprites();
+      if (target)
+      {
+        SDL_SetRenderTarget(renderer, target.get());
+      }
+      SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderClear(renderer);
+    }
+
+    void fillRects(const SDL_Rect *rects, int count, SDL_Color color) override
+    {
+      flushSprites();
+      SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderFillRects(renderer, rects, count);
+    }
+
+    void drawRects(const SDL_Rect *rects, int count, SDL_Color color) override
+    {
+      flushSprites();
+      SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, color.a);
+      SDL_RenderDrawRects(renderer, rects, count);
+    }
+
+    void present() override
+    {
+      flushSprites();
+      if (target)
+      {
+        SDL_SetRenderTarget(renderer, nullptr);
+        SDL_RenderCopy(renderer, target.get(), &targetArea, nullptr);
+      }
+      SDL_RenderPresent(renderer);
+      imageUploadsLeft = MAX_IMAGE_UPLOADS;
+      if (atlas)
+      {
+        atlas->endFrame();
+      }
+    }
+  };
+
+  // Fills a run of 32-bit pixels. The AVX2 variant writes eight pixels per
+  // store and is picked at runtime when the CPU supports it.
+  using SpanFill = void (*)(Uint32 *dst, int count, Uint32 pixel);
+
+  static void fillSpanScalar(Uint32 *dst, int count, Uint32 pixel)
+  {
+    std::fill_n(dst, count, pixel);
+  }
+
+#if defined(HAVE_AVX2_TARGET)
+  __attribute__((target("avx2"))) static void
+  fillSpanAvx2(Uint32 *dst, int count, Uint32 pixel)
+  {
+    const __m256i v = _mm256_set1_epi32(static_cast<int>(pixel));
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), v);
+    }
+    for (; i < count; ++i)
+    {
+      dst[i] = pixel;
+    }
+  }
+#endif
+
+  static SpanFill selectSpanFill()
+  {
+#if defined(HAVE_AVX2_TARGET)
+    if (SDL_HasAVX2())
+    {
+      return fillSpanAvx2;
+    }
+#endif
+    return fillSpanScalar;
+  }
+
+  // Rasterizes in software with span fills, instead of one SDL_Renderer
+  // fill and outline per object. The target is either a streaming texture
+  // presented through SDL_Renderer, or the window surface itself, in which
+  // case only the damaged areas are sent with SDL_UpdateWindowSurfaceRects.
+  //
+  // Draw calls are only recorded as span fills (an outline is four thin
+  // fills); present() bins them into TILE_SIZE tiles and rasterizes the
+  // damaged tiles in parallel, each applying its fills in submission order
+  // so z-order is kept. Undamaged tiles keep last frame's pixels.
+  class SoftwareBackend : public RenderBackend
+  {
+  private:
+    static constexpr int TILE_SIZE = 64;
+
+    struct Fill
+    {
+      SDL_Rect rect;
+      Uint32 pixel;
+    };
+
+    SDL_Renderer *renderer = nullptr;
+    SDL_Window *window = nullptr;
+    ThreadPool &pool;
+    std::unique_ptr<SDL_Texture, SDL_Deleter> texture;
+    std::vector<Uint32> ownPixels;
+    SDL_Surface *surface = nullptr;
+    Uint32 *pixels = nullptr;
+    int pitch = 0; // in pixels
+    int width;
+    int height;
+    int tileColumns;
+    int tileRows;
+    SpanFill fillSpan;
+
+    Uint32 clearPixel = 0;
+    std::vector<Fill> fills;
+    std::vector<std::vector<Uint32>> bins;
+    std::vector<Uint8> tileDamaged;
+    std::vector<size_t> damagedTiles;
+    std::vector<SDL_Rect> updateRects;
+    size_t presented = 0;
+
+    Uint32 pixelOf(SDL_Color color) const
+    {
+      if (surface)
+      {
+        return SDL_MapRGBA(surface->format, color.r, color.g, color.b,
+                           color.a);
+      }
+      return (Uint32(color.a) << 24) | (Uint32(color.r) << 16) |
+             (Uint32(color.g) << 8) | color.b;
+    }
+
+    void record(const SDL_Rect &rect, Uint32 pixel)
+    {
+      if (rect.w > 0 && rect.h > 0)
+      {
+        fills.push_back(Fill{rect, pixel});
+      }
+    }
+
+    // Fills rect clipped to clip
+    void fill(const SDL_Rect &rect, const SDL_Rect &clip, Uint32 pixel)
+    {
+      int x0 = std::max(rect.x, clip.x);
+      int y0 = std::max(rect.y, clip.y);
+      int x1 = std::min(rect.x + rect.w, clip.x + clip.w);
+      int y1 = std::min(rect.y + rect.h, clip.y + clip.h);
+      if (x0 >= x1)
+      {
+        return;
+      }
+      for (int y = y0; y < y1; ++y)
+      {
+        fillSpan(&pixels[static_cast<size_t>(y) * pitch + x0], x1 - x0, pixel);
+      }
+    }
+
+    SDL_Rect tileRect(size_t tile) const
+    {
+      int tx = static_cast<int>(tile % tileColumns) * TILE_SIZE;
+      int ty = static_cast<int>(tile / tileColumns) * TILE_SIZE;
+      return SDL_Rect{tx, ty, std::min(TILE_SIZE, width - tx),
+                      std::min(TILE_SIZE, height - ty)};
+    }
+
+    // Calls visit(tile) for every tile overlapped by rect
+    template <typename Visit> void forEachTile(const SDL_Rect &r, Visit &&visit)
+    {
+      int x0 = std::max(r.x, 0);
+      int y0 = std::max(r.y, 0);
+      int x1 = std::min(r.x + r.w, width);
+      int y1 = std::min(r.y + r.h, height);
+      if (x0 >= x1 || y0 >= y1)
+      {
+        return;
+      }
+      for (int ty = y0 / TILE_SIZE; ty <= (y1 - 1) / TILE_SIZE; ++ty)
+      {
+        for (int tx = x0 / TILE_SIZE; tx <= (x1 - 1) / TILE_SIZE; ++tx)
+        {
+          visit(static_cast<size_t>(ty * tileColumns + tx));
+        }
+      }
+    }
+
+    void bin()
+    {
+      for (size_t tile : damagedTiles)
+      {
+        bins[tile].clear();
+      }
+      for (size_t i = 0; i < fills.size(); ++i)
+      {
+        forEachTile(fills[i].rect, [&](size_t tile) {
+          if (tileDamaged[tile])
+          {
+            bins[tile].push_back(static_cast<Uint32>(i));
+          }
+        });
+      }
+    }
+
+    void rasterizeTile(size_t tile)
+    {
+      SDL_Rect clip = tileRect(tile);
+      fill(clip, clip, clearPixel);
+      for (Uint32 index : bins[tile])
+      {
+        fill(fills[index].rect, clip, fills[index].pixel);
+      }
+    }
+
+    // Damaged tiles as rects, merging horizontal runs within a tile row
+    void collectUpdateRects()
+    {
+      updateRects.clear();
+      presented = 0;
+      for (size_t tile : damagedTiles)
+      {
+        SDL_Rect rect = tileRect(tile);
+        presented += static_cast<size_t>(rect.w) * rect.h;
+        if (!updateRects.empty())
+        {
+          SDL_Rect &last = updateRects.back();
+          if (last.y == rect.y && last.x + last.w == rect.x)
+          {
+            last.w += rect.w;
+            continue;
+          }
+        }
+        updateRects.push_back(rect);
+      }
+    }
+
+    void init()
+    {
+      bins.resize(tileColumns * tileRows);
+      setDamage(nullptr);
+    }
+
+  public:
+    // Renders into a streaming texture presented with SDL_Renderer
+    SoftwareBackend(SDL_Renderer *r, ThreadPool &p, int w, int h)
+        : renderer(r), pool(p), ownPixels(static_cast<size_t>(w) * h),
+          pixels(ownPixels.data()), pitch(w), width(w), height(h),
+          tileColumns((w + TILE_SIZE - 1) / TILE_SIZE),
+          tileRows((h + TILE_SIZE - 1) / TILE_SIZE), fillSpan(selectSpanFill())
+    {
+      texture.reset(SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+                                      SDL_TEXTUREACCESS_STREAMING, w, h));
+      if (!texture)
+      {
+        throw std::runtime_error(std::string("Texture creation failed: ") +
+                                 SDL_GetError());
+      }
+      init();
+    }
+
+    // Renders straight into the window surface. The window must not have
+    // an SDL_Renderer.
+    SoftwareBackend(SDL_Window *win, ThreadPool &p)
+        : window(win), pool(p), surface(SDL_GetWindowSurface(win)),
+          width(0), height(0), tileColumns(0), tileRows(0),
+          fillSpan(selectSpanFill())
+    {
+      if (!surface)
+      {
+        throw std::runtime_error(std::string("Window surface failed: ") +
+                                 SDL_GetError());
+      }
+      if (surface->format->BytesPerPixel != 4)
+      {
+        throw std::runtime_error("Window surface is not 32 bits per pixel");
+      }
+      pixels = static_cast<Uint32 *>(surface->pixels);
+      pitch = surface->pitch / 4;
+      width = surface->w;
+      height = surface->h;
+      tileColumns = (width + TILE_SIZE - 1) / TILE_SIZE;
+      tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+      init();
+    }
+
+    const char *name() const override
+    {
+      if (surface)
+      {
+        return fillSpan == fillSpanScalar ? "surface" : "surface-avx2";
+      }
+      return fillSpan == fillSpanScalar ? "software" : "software-avx2";
+    }
+
+    void setDamage(const std::vector<SDL_Rect> *rects) override
+    {
+      tileDamaged.assign(bins.size(), rects ? 0 : 1);
+      if (rects)
+      {
+        for (const SDL_Rect &rect : *rects)
+        {
+          forEachTile(rect, [this](size_t tile) { tileDamaged[tile] = 1; });
+        }
+      }
+      damagedTiles.clear();
+      for (size_t tile = 0; tile < bins.size(); ++tile)
+      {
+        if (tileDamaged[tile])
+        {
+          damagedTiles.push_back(tile);
+        }
+      }
+    }
+
+    size_t presentedPixels() const override { return presented; }
+
+    // Shrinks the rasterized area; only the texture path can stretch it
+    bool setResolutionScale(double scale) override
+    {
+      if (surface)
+      {
+        return scale == 1.0;
+      }
+      int fullWidth = pitch;
+      int fullHeight = static_cast<int>(ownPixels.size() / pitch);
+      width = std::max(1, static_cast<int>(std::ceil(fullWidth * scale)));
+      height = std::max(1, static_cast<int>(std::ceil(fullHeight * scale)));
+      tileColumns = (width + TILE_SIZE - 1) / TILE_SIZE;
+      tileRows = (height + TILE_SIZE - 1) / TILE_SIZE;
+      init();
+      return true;
+    }
+
+    void clear(SDL_Color color) override
+    {
+      fills.clear();
+      clearPixel = pixelOf(color);
+    }
+
+    void fillRects(const SDL_Rect *rects, int count, SDL_Color color) override
+    {
+      Uint32 pixel = pixelOf(color);
+      for (int i = 0; i < count; ++i)
+      {
+        record(rects[i], pixel);
+      }
+    }
+
+    // One-pixel outlines matching SDL_RenderDrawRect
+    void drawRects(const SDL_Rect *rects, int count, SDL_Color color) override
+    {
+      Uint32 pixel = pixelOf(color);
+      for (int i = 0; i < count; ++i)
+      {
+        const SDL_Rect &r = rects[i];
+        record(SDL_Rect{r.x, r.y, r.w, 1}, pixel);
+        record(SDL_Rect{r.x, r.y + r.h - 1, r.w, 1}, pixel);
+        record(SDL_Rect{r.x, r.y + 1, 1, r.h - 2}, pixel);
+        record(SDL_Rect{r.x + r.w - 1, r.y + 1, 1, r.h - 2}, pixel);
+      }
+    }
+
+    void present() override
+    {
+      bin();
+      if (surface)
+      {
+        SDL_LockSurface(surface);
+      }
+      pool.parallelFor(damagedTiles.size(), [this](size_t i) {
+        rasterizeTile(damagedTiles[i]);
+      });
+      collectUpdateRects();
+
+      if (surface)
+      {
+        SDL_UnlockSurface(surface);
+        if (!updateRects.empty())
+        {
+          SDL_UpdateWindowSurfaceRects(window, updateRects.data(),
+                                       static_cast<int>(updateRects.size()));
+        }
+        return;
+      }
+      SDL_Rect area{0, 0, width, height};
+      SDL_UpdateTexture(texture.get(), &area, pixels,
+                        pitch * static_cast<int>(sizeof(Uint32)));
+      SDL_RenderCopy(renderer, texture.get(), &area, nullptr);
+      SDL_RenderPresent(renderer);
+      presented = static_cast<size_t>(width) * height;
+    }
+  };
+
+  // Draw commands of one frame in window coordinates, in painter's order.
+  // render() records into it, the optimization passes rewrite it and
+  // submit() replays it on the active backend. Overlays are drawn on top
+  // of the scene as filled rects and are never reordered.
+  class CommandBuffer
+  {
+  public:
+    enum class Type : Uint8
+    {
+      Fill,
+      Outline,
+      Overlay,
+      Sprite,
+      Image
+    };
+
+    // Sprites are whole objects: color is the fill, border the outline.
+    // Images carry their image id and average color.
+    struct Command
+    {
+      Type type;
+      SDL_Color color;
+      SDL_Rect rect;
+      SDL_Color border;
+      Uint32 image = 0;
+    };
+
+    SDL_Color clearColor{240, 240, 240, 255};
+    std::vector<Command> commands;
+
+  private:
+    // How many batches a command may sink past, bounding the pass to
+    // linear time
+    static constexpr size_t BATCH_LOOKBACK = 32;
+
+    // Commands sharing a key, with a coarse map of the window cells they
+    // touch once they are too many to test one by one. The map may report
+    // overlaps that are not there, which only costs a missed merge.
+    struct Batch
+    {
+      static constexpr int CELL = 16;
+      static constexpr size_t EXACT_LIMIT = 16;
+
+      Uint64 key = 0;
+      std::vector<Command> items;
+      SDL_Rect bounds{0, 0, 0, 0};
+      std::vector<Uint8> cells;
+
+      template <typename Visit>
+      static void forEachCell(const SDL_Rect &rect, Visit &&visit)
+      {
+        int x0 = std::clamp(rect.x / CELL, 0, CELL_COLUMNS - 1);
+        int y0 = std::clamp(rect.y / CELL, 0, CELL_ROWS - 1);
+        int x1 = std::clamp((rect.x + rect.w - 1) / CELL, 0, CELL_COLUMNS - 1);
+        int y1 = std::clamp((rect.y + rect.h - 1) / CELL, 0, CELL_ROWS - 1);
+        for (int cy = y0; cy <= y1; ++cy)
+        {
+          for (int cx = x0; cx <= x1; ++cx)
+          {
+            if (visit(cy * CELL_COLUMNS + cx))
+            {
+              return;
+            }
+          }
+        }
+      }
+
+      static constexpr int CELL_COLUMNS = (WINDOW_WIDTH + CELL - 1) / CELL;
+      static constexpr int CELL_ROWS = (WINDOW_HEIGHT + CELL - 1) / CELL;
+
+      void mark(const SDL_Rect &rect)
+      {
+        forEachCell(rect, [this](int cell) {
+          cells[cell] = 1;
+          return false;
+        });
+      }
+
+      void add(const Command &command)
+      {
+        if (items.empty())
+        {
+          bounds = command.rect;
+        }
+        else
+        {
+          SDL_UnionRect(&bounds, &command.rect, &bounds);
+        }
+        items.push_back(command);
+        if (items.size() == EXACT_LIMIT)
+        {
+          cells.assign(CELL_COLUMNS * CELL_ROWS, 0);
+          for (const Command &item : items)
+          {
+            mark(item.rect);
+          }
+        }
+        else if (items.size() > EXACT_LIMIT)
+        {
+          mark(command.rect);
+        }
+      }
+
+      bool overlaps(const SDL_Rect &rect) const
+      {
+        if (!SDL_HasIntersection(&bounds, &rect))
+        {
+          return false;
+        }
+        if (items.size() >= EXACT_LIMIT)
+        {
+          bool hit = false;
+          forEachCell(rect, [&](int cell) { return hit = cells[cell] != 0; });
+          return hit;
+        }
+        for (const Command &item : items)
+        {
+          if (SDL_HasIntersection(&item.rect, &rect))
+          {
+            return true;
+          }
+        }
+        return false;
+      }
+    };
+
+    std::vector<Batch> batches;
+    mutable std::vector<SDL_Rect> runRects;
+
+    static Uint32 packColor(const SDL_Color &color)
+    {
+      return (Uint32(color.r) << 24) | (Uint32(color.g) << 16) |
+             (Uint32(color.b) << 8) | color.a;
+    }
+
+    // Type in the top byte, then the sprite border's RGB, then the color.
+    // Images sort by image id instead.
+    static Uint64 sortKey(const Command &command)
+    {
+      if (command.type == Type::Image)
+      {
+        return (Uint64(command.type) << 56) | command.image;
+      }
+      Uint64 border = command.type == Type::Sprite
+                          ? packColor(command.border) >> 8
+                          : 0;
+      return (Uint64(command.type) << 56) | (border << 32) |
+             packColor(command.color);
+    }
+
+    static bool sameColor(const SDL_Color &a, const SDL_Color &b)
+    {
+      return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+    }
+
+    static const char *typeName(Type type)
+    {
+      switch (type)
+      {
+      case Type::Fill:
+        return "fill";
+      case Type::Outline:
+        return "outline";
+      case Type::Sprite:
+        return "sprite";
+      case Type::Image:
+        return "image";
+      default:
+        return "overlay";
+      }
+    }
+
+  public:
+    // Maps a window rect to a render target scaled by scale. Both edges
+    // round the same way so rects that touch keep touching; outward rounds
+    // to cover every pixel the rect touches, as damage must.
+    static SDL_Rect scaleRect(const SDL_Rect &rect, double scale,
+                              bool outward = false)
+    {
+      int x0 = static_cast<int>(std::floor(rect.x * scale));
+      int y0 = static_cast<int>(std::floor(rect.y * scale));
+      double right = (rect.x + rect.w) * scale;
+      double bottom = (rect.y + rect.h) * scale;
+      int x1 = static_cast<int>(outward ? std::ceil(right) : std::floor(right));
+      int y1 = static_cast<int>(outward ? std::ceil(bottom) : std::floor(bottom));
+      return SDL_Rect{x0, y0, std::max(x1 - x0, rect.w > 0 ? 1 : 0),
+                      std::max(y1 - y0, rect.h > 0 ? 1 : 0)};
+    }
+
+    void reset(SDL_Color clear)
+    {
+      clearColor = clear;
+      commands.clear();
+    }
+
+    void add(Type type, const SDL_Rect &rect, const SDL_Color &color)
+    {
+      commands.push_back(Command{type, color, rect, SDL_Color{0, 0, 0, 0}});
+    }
+
+    void addSprite(const SDL_Rect &rect, const SDL_Color &fill,
+                   const SDL_Color &border)
+    {
+      commands.push_back(Command{Type::Sprite, fill, rect, border});
+    }
+
+    void addImage(const SDL_Rect &rect, Uint32 image, const SDL_Color &average)
+    {
+      commands.push_back(
+          Command{Type::Image, average, rect, SDL_Color{0, 0, 0, 0}, image});
+    }
+
+    // Drops empty commands and those entirely outside the window. Returns
+    // the number removed.
+    size_t cull(int width, int height)
+    {
+      SDL_Rect window{0, 0, width, height};
+      size_t before = commands.size();
+      commands.erase(std::remove_if(commands.begin(), commands.end(),
+                                    [&](const Command &command) {
+                                      return !SDL_HasIntersection(
+                                          &command.rect, &window);
+                                    }),
+                     commands.end());
+      return before - commands.size();
+    }
+
+    // Number of color/type switches a straight submission would make
+    size_t stateChanges() const
+    {
+      size_t changes = 0;
+      for (size_t i = 0; i < commands.size(); ++i)
+      {
+        if (i == 0 || sortKey(commands[i]) != sortKey(commands[i - 1]))
+        {
+          ++changes;
+        }
+      }
+      return changes;
+    }
+
+    // Regroups the stream so commands of the same type and color are
+    // contiguous, without changing what ends up on screen. Commands are
+    // walked from last to first and each one sinks towards the end into
+    // the nearest later batch with its key, as long as it does not overlap
+    // any batch it would jump over. Only solid fills and outlines of one
+    // key commute when they overlap; a sprite (fill, then border) or an
+    // image joins a batch only if it overlaps none of its commands, and
+    // starts a new one otherwise. Overlays are barriers. Returns the
+    // number of state changes removed.
+    size_t batchByColor()
+    {
+      size_t before = stateChanges();
+      batches.clear();
+      for (size_t i = commands.size(); i-- > 0;)
+      {
+        const Command &command = commands[i];
+        Uint64 key = sortKey(command);
+        Batch *target = nullptr;
+        size_t scanned = 0;
+        for (size_t b = batches.size(); b-- > 0 && scanned < BATCH_LOOKBACK;
+             ++scanned)
+        {
+          Batch &batch = batches[b];
+          bool solid =
+              command.type == Type::Fill || command.type == Type::Outline;
+          if (batch.key == key && command.type != Type::Overlay &&
+              (solid || !batch.overlaps(command.rect)))
+          {
+            target = &batch;
+            break;
+          }
+          if (batch.key >> 56 == Uint64(Type::Overlay) ||
+              batch.overlaps(command.rect))
+          {
+            break;
+          }
+        }
+        if (!target)
+        {
+          batches.emplace_back();
+          target = &batches.back();
+          target->key = key;
+        }
+        target->add(command);
+      }
+
+      commands.clear();
+      for (size_t b = batches.size(); b-- > 0;)
+      {
+        commands.insert(commands.end(), batches[b].items.rbegin(),
+                        batches[b].items.rend());
+      }
+      return before - stateChanges();
+    }
+
+    // Joins consecutive same-color fills that share an edge into one rect.
+    // Returns the number of commands removed.
+    size_t mergeSpans()
+    {
+      if (commands.empty())
+      {
+        return 0;
+      }
+      size_t out = 0;
+      for (size_t i = 1; i < commands.size(); ++i)
+      {
+        Command &last = commands[out];
+        const Command &next = commands[i];
+        if (last.type == Type::Fill && next.type == Type::Fill &&
+            sameColor(last.color, next.color))
+        {
+          SDL_Rect &a = last.rect;
+          const SDL_Rect &b = next.rect;
+          if (a.y == b.y && a.h == b.h && a.x + a.w == b.x)
+          {
+            a.w += b.w;
+            continue;
+          }
+          if (a.x == b.x && a.w == b.w && a.y + a.h == b.y)
+          {
+            a.h += b.h;
+            continue;
+          }
+        }
+        commands[++out] = next;
+      }
+      size_t removed = commands.size() - (out + 1);
+      commands.resize(out + 1);
+      return removed;
+    }
+
+    // Sends each run of same-key commands as one fillRects/drawRects call,
+    // with rects scaled to a render target of scale times the window size
+    void submit(RenderBackend &backend, double scale = 1.0) const
+    {
+      auto target = [scale](const SDL_Rect &rect)
+      { return scale == 1.0 ? rect : scaleRect(rect, scale); };
+      backend.clear(clearColor);
+      size_t i = 0;
+      while (i < commands.size())
+      {
+        const Command &first = commands[i];
+        if (first.type == Type::Sprite)
+        {
+          backend.drawSprite(target(first.rect), first.color, first.border);
+          ++i;
+          continue;
+        }
+        if (first.type == Type::Image)
+        {
+          backend.drawImage(target(first.rect), first.image, first.color);
+          ++i;
+          continue;
+        }
+        runRects.clear();
+        for (; i < commands.size() && sortKey(commands[i]) == sortKey(first);
+             ++i)
+        {
+          runRects.push_back(target(commands[i].rect));
+        }
+        int count = static_cast<int>(runRects.size());
+        if (first.type == Type::Outline)
+        {
+          backend.drawRects(runRects.data(), count, first.color);
+        }
+        else
+        {
+          backend.fillRects(runRects.data(), count, first.color);
+        }
+      }
+    }
+
+    // Plain text, one command per line, for replaying offline. Image ids
+    // mean nothing to another run, so images load back as their average
+    // color.
+    void save(const std::string &path) const
+    {
+      std::ofstream out(path);
+      if (!out)
+      {
+        throw std::runtime_error("Cannot write " + path);
+      }
+      out << "# multi_drag render commands v1\n";
+      out << "clear " << int(clearColor.r) << ' ' << int(clearColor.g) << ' '
+          << int(clearColor.b) << ' ' << int(clearColor.a) << '\n';
+      for (const Command &c : commands)
+      {
+        out << typeName(c.type) << ' ' << c.rect.x << ' ' << c.rect.y << ' '
+            << c.rect.w << ' ' << c.rect.h << ' ' << int(c.color.r) << ' '
+            << int(c.color.g) << ' ' << int(c.color.b) << ' '
+            << int(c.color.a);
+        if (c.type == Type::Sprite)
+        {
+          out << ' ' << int(c.border.r) << ' ' << int(c.border.g) << ' '
+              << int(c.border.b) << ' ' << int(c.border.a);
+        }
+        out << '\n';
+      }
+    }
+
+    void load(const std::string &path)
+    {
+      std::ifstream in(path);
+      if (!in)
+      {
+        throw std::runtime_error("Cannot read " + path);
+      }
+      commands.clear();
+      std::string line;
+      size_t lineNumber = 0;
+      while (std::getline(in, line))
+      {
+        ++lineNumber;
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name.empty() || name[0] == '#')
+        {
+          continue;
+        }
+        int v[12] = {};
+        if (name == "clear")
+        {
+          fields >> v[0] >> v[1] >> v[2] >> v[3];
+          clearColor = SDL_Color{Uint8(v[0]), Uint8(v[1]), Uint8(v[2]),
+                                 Uint8(v[3])};
+          continue;
+        }
+        if (name != "fill" && name != "outline" && name != "sprite" &&
+            name != "image" && name != "overlay")
+        {
+          // Possibly a newer dump; drawing it as something else would be
+          // wrong without notice
+          throw std::runtime_error("Unknown command \"" + name + "\" in " +
+                                   path + " at line " +
+                                   std::to_string(lineNumber));
+        }
+        int count = name == "sprite" ? 12 : 8;
+        for (int k = 0; k < count; ++k)
+        {
+          fields >> v[k];
+        }
+        if (!fields)
+        {
+          throw std::runtime_error("Malformed command in " + path + ": " +
+                                   line);
+        }
+        SDL_Rect rect{v[0], v[1], v[2], v[3]};
+        SDL_Color color{Uint8(v[4]), Uint8(v[5]), Uint8(v[6]), Uint8(v[7])};
+        if (name == "sprite")
+        {
+          addSprite(rect, color,
+                    SDL_Color{Uint8(v[8]), Uint8(v[9]), Uint8(v[10]),
+                              Uint8(v[11])});
+          continue;
+        }
+        Type type = name == "fill" || name == "image" ? Type::Fill
+                    : name == "outline"                 ? Type::Outline
+                                                        : Type::Overlay;
+        add(type, rect, color);
+      }
+    }
+  };
+
+  // One object attribute as a persistent two-level vector: a table of
+  // fixed-size chunks, both held by shared pointers. Copying a column only
+  // shares the table, so it is O(1) however large the column. The first
+  // write through a copy clones the table (one pointer per chunk) and then
+  // the chunk it touches; untouched chunks stay shared between versions.
+  // A chunk may also point into a mapped scene file. Reading never copies.
+  template <typename T> class Column
+  {
+  public:
+    using value_type = T;
+    static constexpr size_t CHUNK_SIZE = SCENE_CHUNK_SIZE;
+
+  private:
+    using Table = std::vector<std::shared_ptr<T>>;
+    std::shared_ptr<Table> table = std::make_shared<Table>();
+    size_t count = 0;
+
+    // Sole owners may write in place; the fences pair with the release of
+    // a copy dropped on another thread, e.g. a snapshot just written out
+    Table &writableTable()
+    {
+      if (table.use_count() > 1)
+      {
+        table = std::make_shared<Table>(*table);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return *table;
+    }
+
+    T *writable(size_t chunk)
+    {
+      std::shared_ptr<T> &data = writableTable()[chunk];
+      if (data.use_count() > 1)
+      {
+        std::shared_ptr<T> copy(new T[CHUNK_SIZE], std::default_delete<T[]>());
+        std::copy_n(data.get(), CHUNK_SIZE, copy.get());
+        data = std::move(copy);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return data.get();
+    }
+
+    void grow()
+    {
+      writableTable().emplace_back(new T[CHUNK_SIZE](),
+                                   std::default_delete<T[]>());
+    }
+
+  public:
+    // Uses count elements in place from base, which must hold whole chunks
+    // and stay valid while owner lives
+    static Column mapped(const std::shared_ptr<void> &owner, T *base,
+                         size_t count)
+    {
+      Column column;
+      for (size_t i = 0; i < count; i += CHUNK_SIZE)
+      {
+        column.table->emplace_back(owner, base + i);
+      }
+      column.count = count;
+      return column;
+    }
+
+    size_t size() const { return count; }
+
+    const T &operator[](size_t i) const
+    {
+      return (*table)[i / CHUNK_SIZE].get()[i % CHUNK_SIZE];
+    }
+
+    void set(size_t i, const T &value)
+    {
+      writable(i / CHUNK_SIZE)[i % CHUNK_SIZE] = value;
+    }
+
+    void push_back(const T &value)
+    {
+      if (count == table->size() * CHUNK_SIZE)
+      {
+        grow();
+      }
+      set(count++, value);
+    }
+
+    // Appends n elements, copying a chunk at a time
+    void append(const T *data, size_t n)
+    {
+      while (n > 0)
+      {
+        if (count == table->size() * CHUNK_SIZE)
+        {
+          grow();
+        }
+        size_t offset = count % CHUNK_SIZE;
+        size_t take = std::min(n, CHUNK_SIZE - offset);
+        std::copy_n(data, take, writable(count / CHUNK_SIZE) + offset);
+        count += take;
+        data += take;
+        n -= take;
+      }
+    }
+
+    void fill(const T &value)
+    {
+      for (size_t chunk = 0; chunk < table->size(); ++chunk)
+      {
+        size_t used = std::min(CHUNK_SIZE, count - chunk * CHUNK_SIZE);
+        std::fill_n(writable(chunk), used, value);
+      }
+    }
+
+    // True when both columns hold the same memory for chunk. Writes never
+    // go to a chunk another copy still holds, so for a copy that is kept
+    // this means the chunk is unchanged since the copy was made.
+    bool sharesChunk(const Column &other, size_t chunk) const
+    {
+      return chunk < table->size() && chunk < other.table->size() &&
+             (*table)[chunk] == (*other.table)[chunk];
+    }
+
+    // Calls visit(data, n) for the used part of every chunk, in order
+    template <typename Visit> void forEachChunk(Visit &&visit) const
+    {
+      const Table &chunks = *table;
+      for (size_t chunk = 0; chunk < chunks.size(); ++chunk)
+      {
+        visit(static_cast<const T *>(chunks[chunk].get()),
+              std::min(CHUNK_SIZE, count - chunk * CHUNK_SIZE));
+      }
+    }
+  };
+
+  // Append-only log of scene edits, so autosaving costs follow the edit
+  // rate rather than the scene size. Records are buffered in memory and a
+  // writer thread appends them to the current segment file
+  // (<scene>.journal.N), syncing it every commit interval, so one fsync
+  // covers all edits made in that interval. rotate() starts a new segment;
+  // once a snapshot taken after the rotation is saved, compacted() deletes
+  // the segments it covers. Records carry absolute values keyed by object
+  // id, so replaying edits the scene file already holds changes nothing.
+  class SceneJournal
+  {
+  public:
+    enum class Op : Uint8
+    {
+      Add = 1,
+      Move,
+      Raise,
+      Recolor,
+      Delete
+    };
+
+    // The object's state after the edit. Add records are followed by
+    // pathLength bytes of image path.
+    struct Record
+    {
+      Uint32 checksum; // FNV-1a of the rest of the record and the path
+      Op op;
+      Uint8 reserved;
+      Uint16 pathLength;
+      Uint64 id;
+      Sint32 x, y, w, h;
+      Uint32 z;
+      SDL_Color color;
+    };
+    static_assert(sizeof(Record) == 40, "journal record layout");
+
+  private:
+    struct Segment
+    {
+      Uint64 number;
+      std::vector<char> bytes;
+    };
+
+    std::string basePath;
+    std::chrono::milliseconds commitInterval;
+    std::function<std::string(Uint32)> imagePath;
+    size_t sinceRotate = 0; // bytes, only used by the appending thread
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Segment> queued; // back() takes new records
+    Uint64 dropThrough = 0;
+    bool stopping = false;
+    std::thread thread; // last, so it starts after the rest is set up
+
+    static Uint32 checksum(const Record &record, const char *path)
+    {
+      Uint32 hash = 2166136261u;
+      auto mix = [&](const void *data, size_t size)
+      {
+        const Uint8 *bytes = static_cast<const Uint8 *>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+          hash = (hash ^ bytes[i]) * 16777619u;
+        }
+      };
+      mix(reinterpret_cast<const Uint8 *>(&record) + sizeof(record.checksum),
+          sizeof(record) - sizeof(record.checksum));
+      mix(path, record.pathLength);
+      return hash;
+    }
+
+    static std::string segmentPath(const std::string &basePath, Uint64 number)
+    {
+      return basePath + ".journal." + std::to_string(number);
+    }
+
+    // Numbers of the segment files of basePath, ascending
+    static std::vector<Uint64> segmentNumbers(const std::string &basePath)
+    {
+      std::filesystem::path base(basePath);
+      std::filesystem::path directory =
+          base.has_parent_path() ? base.parent_path() : ".";
+      std::string prefix = base.filename().string() + ".journal.";
+      std::vector<Uint64> numbers;
+      std::error_code error;
+      for (const auto &entry :
+           std::filesystem::directory_iterator(directory, error))
+      {
+        std::string name = entry.path().filename().string();
+        if (name.size() > prefix.size() &&
+            name.compare(0, prefix.size(), prefix) == 0 &&
+            std::all_of(name.begin() + prefix.size(), name.end(),
+                        [](char c) { return std::isdigit(Uint8(c)) != 0; }))
+        {
+          numbers.push_back(std::stoull(name.substr(prefix.size())));
+        }
+      }
+      std::sort(numbers.begin(), numbers.end());
+      return numbers;
+    }
+
+    void writerLoop()
+    {
+      FILE *out = nullptr;
+      Uint64 openNumber = 0;
+      Uint64 dropped = 0;
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+      {
+        wake.wait_for(lock, commitInterval, [this] { return stopping; });
+        bool stop = stopping;
+        std::vector<Segment> segments;
+        segments.swap(queued);
+        queued.push_back(Segment{segments.back().number, {}});
+        Uint64 drop = dropThrough;
+        lock.unlock();
+
+        bool ok = true;
+        bool wrote = false;
+        for (const Segment &segment : segments)
+        {
+          if (segment.bytes.empty())
+          {
+            continue;
+          }
+          if (!out || segment.number != openNumber)
+          {
+            if (out)
+            {
+              ok = syncFile(out) && ok;
+              std::fclose(out);
+            }
+            openNumber = segment.number;
+            out = std::fopen(segmentPath(basePath, openNumber).c_str(), "ab");
+          }
+          ok = out &&
+               std::fwrite(segment.bytes.data(), 1, segment.bytes.size(),
+                           out) == segment.bytes.size() &&
+               ok;
+          wrote = true;
+        }
+        if (out && wrote)
+        {
+          ok = syncFile(out) && ok;
+        }
+        if (!ok)
+        {
+          std::cerr << "Error: cannot write journal "
+                    << segmentPath(basePath, openNumber) << std::endl;
+        }
+
+        if (drop > dropped)
+        {
+          if (out && openNumber <= drop)
+          {
+            std::fclose(out);
+            out = nullptr;
+          }
+          for (Uint64 number : segmentNumbers(basePath))
+          {
+            if (number <= drop)
+            {
+              std::remove(segmentPath(basePath, number).c_str());
+            }
+          }
+          dropped = drop;
+        }
+
+        lock.lock();
+        if (stop)
+        {
+          break;
+        }
+      }
+      if (out)
+      {
+        std::fclose(out);
+      }
+    }
+
+  public:
+    // New records go to a segment after any already on disk, whose bytes
+    // count towards pendingBytes() until the next compaction
+    SceneJournal(const std::string &scenePath, Uint32 commitMs,
+                 std::function<std::string(Uint32)> imagePathOf)
+        : basePath(scenePath), commitInterval(commitMs),
+          imagePath(std::move(imagePathOf))
+    {
+      std::vector<Uint64> existing = segmentNumbers(basePath);
+      for (Uint64 number : existing)
+      {
+        std::error_code error;
+        uintmax_t size =
+            std::filesystem::file_size(segmentPath(basePath, number), error);
+        sinceRotate += error ? 0 : static_cast<size_t>(size);
+      }
+      queued.push_back(Segment{existing.empty() ? 1 : existing.back() + 1, {}});
+      thread = std::thread([this] { writerLoop(); });
+    }
+
+    // Writes and syncs whatever is still buffered
+    ~SceneJournal()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      thread.join();
+    }
+
+    SceneJournal(const SceneJournal &) = delete;
+    SceneJournal &operator=(const SceneJournal &) = delete;
+
+    // image is the ImageLoader id of an Add record's object, 0 for none
+    void append(Record record, Uint32 image = 0)
+    {
+      std::string path = image ? imagePath(image) : std::string();
+      record.pathLength =
+          static_cast<Uint16>(std::min<size_t>(path.size(), UINT16_MAX));
+      record.checksum = checksum(record, path.data());
+      const char *raw = reinterpret_cast<const char *>(&record);
+      std::lock_guard<std::mutex> lock(mutex);
+      std::vector<char> &bytes = queued.back().bytes;
+      bytes.insert(bytes.end(), raw, raw + sizeof(record));
+      bytes.insert(bytes.end(), path.data(), path.data() + record.pathLength);
+      sinceRotate += sizeof(record) + record.pathLength;
+    }
+
+    // Bytes logged since the last rotation
+    size_t pendingBytes() const { return sinceRotate; }
+
+    // Starts a new segment and returns the number of the last one holding
+    // edits made before the call
+    Uint64 rotate()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Uint64 sealed = queued.back().number;
+      queued.push_back(Segment{sealed + 1, {}});
+      sinceRotate = 0;
+      return sealed;
+    }
+
+    // Deletes the segments up to and including through, once a snapshot
+    // holding their edits is on disk. May be called from any thread.
+    void compacted(Uint64 through)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      dropThrough = std::max(dropThrough, through);
+    }
+
+    // Calls visit(record, imagePath) for every intact record of the
+    // scene's segments, oldest first, and returns how many there were.
+    // A segment is read up to its first torn or corrupt record, which can
+    // only be the tail being written when the process stopped.
+    template <typename Visit>
+    static size_t recover(const std::string &scenePath, Visit &&visit)
+    {
+      size_t count = 0;
+      for (Uint64 number : segmentNumbers(scenePath))
+      {
+        std::ifstream in(segmentPath(scenePath, number), std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+        size_t at = 0;
+        while (bytes.size() - at >= sizeof(Record))
+        {
+          Record record;
+          std::memcpy(&record, bytes.data() + at, sizeof(record));
+          const char *path = bytes.data() + at + sizeof(record);
+          if (bytes.size() - at - sizeof(record) < record.pathLength ||
+              checksum(record, path) != record.checksum)
+          {
+            break;
+          }
+          visit(record, std::string(path, record.pathLength));
+          at += sizeof(record) + record.pathLength;
+          ++count;
+        }
+      }
+      return count;
+    }
+  };
+
+  // Undo and redo stacks of compact edit records. A step is one user
+  // action, e.g. a drag, which raises and then moves its objects. Objects
+  // are listed as runs of consecutive slots, so edits of a whole selection
+  // stay small, and a move stores one shared delta plus the objects whose
+  // own delta differs, e.g. those stopped at the world edge. Past the
+  // byte budget the oldest steps are dropped.
+  class UndoHistory
+  {
+  public:
+    enum class Kind : Uint8
+    {
+      Add,
+      Delete,
+      Move,
+      Raise,
+      Recolor
+    };
+
+    struct Edit
+    {
+      Kind kind;
+      std::vector<Uint32> runs; // first slot and count, ascending
+      int dx = 0;               // Move: the shared delta
+      int dy = 0;
+      Uint32 firstZ = 0; // Raise: new z of the lowest raised object
+      // Per object, in slot order: old z for Raise, old and new color for
+      // Recolor. Move lists slot, dx, dy of the objects with their own
+      // delta.
+      std::vector<Uint32> values;
+
+      Edit(Kind editKind, const std::vector<size_t> &sortedSlots)
+          : kind(editKind)
+      {
+        for (size_t slot : sortedSlots)
+        {
+          addSlot(slot);
+        }
+      }
+
+      void addSlot(size_t slot)
+      {
+        if (!runs.empty() && runs[runs.size() - 2] + runs.back() == slot)
+        {
+          ++runs.back();
+          return;
+        }
+        runs.push_back(static_cast<Uint32>(slot));
+        runs.push_back(1);
+      }
+
+      // Calls visit(slot) in ascending order
+      template <typename Visit> void forEachSlot(Visit &&visit) const
+      {
+        for (size_t i = 0; i < runs.size(); i += 2)
+        {
+          for (size_t slot = runs[i]; slot < size_t(runs[i]) + runs[i + 1];
+               ++slot)
+          {
+            visit(slot);
+          }
+        }
+      }
+
+      size_t bytes() const
+      {
+        return sizeof(Edit) +
+               (runs.capacity() + values.capacity()) * sizeof(Uint32);
+      }
+    };
+
+    using Step = std::vector<Edit>;
+
+  private:
+    std::deque<Step> undoSteps;
+    std::vector<Step> redoSteps;
+    size_t budget;
+    size_t used = 0;
+    int groupDepth = 0;
+    bool groupStarted = false;
+
+    static size_t stepBytes(const Step &step)
+    {
+      size_t bytes = sizeof(Step);
+      for (const Edit &edit : step)
+      {
+        bytes += edit.bytes();
+      }
+      return bytes;
+    }
+
+    // Merges adds of neighbouring slots, as a group of spawns makes them
+    static void append(Step &into, Step &&step)
+    {
+      for (Edit &edit : step)
+      {
+        if (edit.kind == Kind::Add && !into.empty() &&
+            into.back().kind == Kind::Add)
+        {
+          edit.forEachSlot([&](size_t slot) { into.back().addSlot(slot); });
+        }
+        else
+        {
+          into.push_back(std::move(edit));
+        }
+      }
+    }
+
+    void trim()
+    {
+      while (used > budget && undoSteps.size() > 1)
+      {
+        used -= stepBytes(undoSteps.front());
+        undoSteps.pop_front();
+      }
+    }
+
+  public:
+    explicit UndoHistory(size_t budgetBytes) : budget(budgetBytes) {}
+
+    void setBudget(size_t budgetBytes)
+    {
+      budget = budgetBytes;
+      trim();
+    }
+
+    size_t bytes() const { return used; }
+
+    // Records a new action, which drops everything that could be redone.
+    // Within a group, all actions recorded are merged into one step.
+    void push(Step step)
+    {
+      if (step.empty())
+      {
+        return;
+      }
+      for (const Step &dropped : redoSteps)
+      {
+        used -= stepBytes(dropped);
+      }
+      redoSteps.clear();
+      if (groupDepth > 0 && groupStarted)
+      {
+        used -= stepBytes(undoSteps.back());
+        append(undoSteps.back(), std::move(step));
+      }
+      else
+      {
+        undoSteps.push_back(std::move(step));
+        groupStarted = groupDepth > 0;
+      }
+      used += stepBytes(undoSteps.back());
+      trim();
+    }
+
+    void beginGroup() { ++groupDepth; }
+
+    void endGroup()
+    {
+      if (--groupDepth == 0)
+      {
+        groupStarted = false;
+      }
+    }
+
+    // The step to undo next, or nullptr; undone() moves it to the redo
+    // stack once applied
+    const Step *nextUndo() const
+    {
+      return undoSteps.empty() ? nullptr : &undoSteps.back();
+    }
+
+    void undone()
+    {
+      redoSteps.push_back(std::move(undoSteps.back()));
+      undoSteps.pop_back();
+      groupStarted = false;
+    }
+
+    const Step *nextRedo() const
+    {
+      return redoSteps.empty() ? nullptr : &redoSteps.back();
+    }
+
+    void redone()
+    {
+      undoSteps.push_back(std::move(redoSteps.back()));
+      redoSteps.pop_back();
+      groupStarted = false;
+    }
+
+    void clear()
+    {
+      undoSteps.clear();
+      redoSteps.clear();
+      used = 0;
+      groupStarted = false;
+    }
+  };
+
+  class ObjectManager
+  {
+  private:
+    // Objects are stored as parallel columns indexed by slot, so bulk
+    // passes can stream over contiguous coordinates. Slots never move;
+    // stacking order is given by zs (higher is drawn later, i.e. on top).
+    // ids are stable across saves, never reused and increase with slot.
+    // Deleted objects stay as tombstones, also in saved files, so undo can
+    // bring them back in place: they only leave the grid and LOD tiles.
+    Column<int> xs, ys, ws, hs;
+    Column<SDL_Color> colors;
+    Column<Uint32> images; // ImageLoader id, 0 for plain rects
+    Column<Uint32> zs;
+    Column<Uint8> selected;
+    Column<Uint64> ids;
+    Column<Uint8> deleted; // may be shorter than the others, see isDeleted
+    Uint32 nextZ = 0;
+    Uint64 nextId = 1;
+    std::shared_ptr<MappedFile> sceneFile; // backs mapped columns
+    SceneJournal *journal = nullptr;       // receives every edit if set
+    UndoHistory history;
+    SpatialGrid grid;
+    LodTiles lod;
+
+    // World areas changed since the last takeDamage(). Past
+    // MAX_DAMAGE_RECTS the list collapses into damageAll, which is also
+    // used for changes too widespread to list.
+    static constexpr size_t MAX_DAMAGE_RECTS = 4096;
+    std::vector<SDL_Rect> damage;
+    bool damageAll = true;
+
+    void markDamaged(const SDL_Rect &rect)
+    {
+      if (damageAll)
+      {
+        return;
+      }
+      if (damage.size() == MAX_DAMAGE_RECTS)
+      {
+        damageAll = true;
+        damage.clear();
+        return;
+      }
+      damage.push_back(rect);
+    }
+
+    // A drag gesture of one pointer: packed start positions and clamp
+    // limits of the dragged objects, translated together on every motion.
+    // An object belongs to at most one session; grabbing it from another
+    // pointer takes it over, recorded in dragOwner.
+    struct DragSession
+    {
+      Uint32 token = 0;
+      std::vector<size_t> slots;
+      std::vector<int> startX, startY, limitX, limitY, outX, outY;
+      int anchorX = 0;
+      int anchorY = 0;
+      int pointerX = 0;
+      int pointerY = 0;
+      UndoHistory::Step step; // the raise, the move is added at the end
+    };
+    std::map<PointerId, DragSession> sessions;
+    std::vector<Uint32> dragOwner; // sized on the first drag
+    std::vector<SDL_Point> dragOrigin; // where a drag first grabbed a slot
+    Uint32 nextSessionToken = 1;
+    size_t stolenCount = 0;
+
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> colorDist;
+
+    void insert(const SDL_Rect &rect, const SDL_Color &color, Uint32 image,
+                Uint32 z, Uint64 id)
+    {
+      xs.push_back(rect.x);
+      ys.push_back(rect.y);
+      ws.push_back(rect.w);
+      hs.push_back(rect.h);
+      colors.push_back(color);
+      images.push_back(image);
+      zs.push_back(z);
+      selected.push_back(0);
+      ids.push_back(id);
+      grid.insert(size() - 1, rect);
+      lod.add(rect, color);
+      markDamaged(rect);
+      markDamaged(LodTiles::tileArea(rect));
+    }
+
+    void log(SceneJournal::Op op, size_t slot)
+    {
+      if (!journal)
+      {
+        return;
+      }
+      SceneJournal::Record record{};
+      record.op = op;
+      record.id = ids[slot];
+      record.x = xs[slot];
+      record.y = ys[slot];
+      record.w = ws[slot];
+      record.h = hs[slot];
+      record.z = zs[slot];
+      record.color = colors[slot];
+      journal->append(record, op == SceneJournal::Op::Add ? images[slot] : 0);
+    }
+
+    void moveTo(size_t slot, int x, int y)
+    {
+      SDL_Rect before = getRect(slot);
+      xs.set(slot, x);
+      ys.set(slot, y);
+      SDL_Rect after = getRect(slot);
+      grid.update(slot, after);
+      if (lod.move(before, after, colors[slot]))
+      {
+        markDamaged(LodTiles::tileArea(before));
+        markDamaged(LodTiles::tileArea(after));
+      }
+      SDL_Rect moved;
+      SDL_UnionRect(&before, &after, &moved);
+      markDamaged(moved);
+    }
+
+    void setColor(size_t slot, const SDL_Color &color)
+    {
+      SDL_Rect rect = getRect(slot);
+      lod.remove(rect, colors[slot]);
+      colors.set(slot, color);
+      lod.add(rect, color);
+      markDamaged(rect);
+      markDamaged(LodTiles::tileArea(rect));
+    }
+
+    void remove(size_t slot)
+    {
+      SDL_Rect rect = getRect(slot);
+      grid.remove(slot);
+      lod.remove(rect, colors[slot]);
+      while (deleted.size() <= slot)
+      {
+        deleted.push_back(0);
+      }
+      deleted.set(slot, 1);
+      if (selected[slot])
+      {
+        selected.set(slot, 0);
+      }
+      if (slot < dragOwner.size())
+      {
+        dragOwner[slot] = 0; // its drag session skips it from now on
+      }
+      markDamaged(rect);
+      markDamaged(LodTiles::tileArea(rect));
+    }
+
+    // Brings a deleted object back in its slot
+    void restore(size_t slot)
+    {
+      deleted.set(slot, 0);
+      SDL_Rect rect = getRect(slot);
+      grid.insert(slot, rect);
+      lod.add(rect, colors[slot]);
+      markDamaged(rect);
+      markDamaged(LodTiles::tileArea(rect));
+    }
+
+    // Reverts or repeats one recorded edit, journaling the changes
+    void apply(const UndoHistory::Edit &edit, bool undo)
+    {
+      using Kind = UndoHistory::Kind;
+      size_t index = 0;
+      size_t exception = 0;
+      edit.forEachSlot([&](size_t slot) {
+        switch (edit.kind)
+        {
+        case Kind::Add:
+        case Kind::Delete:
+          if ((edit.kind == Kind::Add) == undo)
+          {
+            remove(slot);
+            log(SceneJournal::Op::Delete, slot);
+          }
+          else
+          {
+            restore(slot);
+            log(SceneJournal::Op::Add, slot);
+          }
+          break;
+        case Kind::Move:
+        {
+          int dx = edit.dx;
+          int dy = edit.dy;
+          if (exception < edit.values.size() &&
+              edit.values[exception] == slot)
+          {
+            dx = static_cast<int>(edit.values[exception + 1]);
+            dy = static_cast<int>(edit.values[exception + 2]);
+            exception += 3;
+          }
+          int sign = undo ? -1 : 1;
+          moveTo(slot, xs[slot] + sign * dx, ys[slot] + sign * dy);
+          log(SceneJournal::Op::Move, slot);
+          break;
+        }
+        case Kind::Raise:
+          if (undo)
+          {
+            zs.set(slot, edit.values[index]);
+            markDamaged(getRect(slot));
+            log(SceneJournal::Op::Raise, slot);
+          }
+          break;
+        case Kind::Recolor:
+        {
+          Uint32 rgba = edit.values[2 * index + (undo ? 0 : 1)];
+          setColor(slot, SDL_Color{Uint8(rgba >> 24), Uint8(rgba >> 16),
+                                   Uint8(rgba >> 8), Uint8(rgba)});
+          log(SceneJournal::Op::Recolor, slot);
+          break;
+        }
+        }
+        ++index;
+      });
+
+      if (edit.kind == Kind::Raise && !undo)
+      {
+        // Raised objects got consecutive zs in their old stacking order
+        std::vector<std::pair<Uint32, size_t>> order;
+        index = 0;
+        edit.forEachSlot([&](size_t slot)
+                         { order.emplace_back(edit.values[index++], slot); });
+        std::sort(order.begin(), order.end());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+          size_t slot = order[i].second;
+          zs.set(slot, edit.firstZ + static_cast<Uint32>(i));
+          markDamaged(getRect(slot));
+          log(SceneJournal::Op::Raise, slot);
+        }
+      }
+    }
+
+    static Uint32 packColor(const SDL_Color &color)
+    {
+      return Uint32(color.r) << 24 | Uint32(color.g) << 16 |
+             Uint32(color.b) << 8 | color.a;
+    }
+
+  public:
+    explicit ObjectManager(unsigned seed)
+        : history(64 << 20), rng(seed), colorDist(0, 255)
+    {
+      // Create some initial objects
+      addObject(100, 100);
+      addObject(300, 200);
+      addObject(500, 300);
+    }
+
+    SDL_Color generateRandomColor()
+    {
+      return SDL_Color{static_cast<Uint8>(colorDist(rng)),
+                       static_cast<Uint8>(colorDist(rng)),
+                       static_cast<Uint8>(colorDist(rng)), 255};
+    }
+
+  private:
+    // Image objects are gray placeholders until their image is decoded.
+    // Leaves recording the add to the caller.
+    void spawn(int x, int y, Uint32 image)
+    {
+      SDL_Color color =
+          image ? SDL_Color{160, 160, 160, 255} : generateRandomColor();
+      insert(SDL_Rect{std::clamp(x, 0, WORLD_WIDTH - 80),
+                      std::clamp(y, 0, WORLD_HEIGHT - 80), 80, 80},
+             color, image, nextZ++, nextId++);
+      log(SceneJournal::Op::Add, size() - 1);
+    }
+
+  public:
+    void addObject(int x, int y, Uint32 image = 0)
+    {
+      spawn(x, y, image);
+      history.push({UndoHistory::Edit(UndoHistory::Kind::Add, {size() - 1})});
+    }
+
+    // Scatters objects over a world area, for exercising large scenes.
+    // They are recorded as one add of consecutive slots.
+    void addRandomObjects(size_t count, const SDL_Rect &area)
+    {
+      std::uniform_int_distribution<int> xDist(area.x, area.x + area.w - 80);
+      std::uniform_int_distribution<int> yDist(area.y, area.y + area.h - 80);
+      if (count == 0)
+      {
+        return;
+      }
+      UndoHistory::Edit added(UndoHistory::Kind::Add, {});
+      for (size_t i = 0; i < count; ++i)
+      {
+        spawn(xDist(rng), yDist(rng), 0);
+        added.addSlot(size() - 1);
+      }
+      history.push({std::move(added)});
+    }
+
+    // Edits recorded between these are undone and redone as one
+    void beginGroup() { history.beginGroup(); }
+    void endGroup() { history.endGroup(); }
+
+    void setHistoryBudget(size_t bytes) { history.setBudget(bytes); }
+
+    size_t historyBytes() const { return history.bytes(); }
+
+    // Reverts the last recorded action; returns false if there is none.
+    // Drags in progress are ended first, so they are undone first.
+    bool undo()
+    {
+      endAllDrags();
+      const UndoHistory::Step *step = history.nextUndo();
+      if (!step)
+      {
+        return false;
+      }
+      for (auto edit = step->rbegin(); edit != step->rend(); ++edit)
+      {
+        apply(*edit, true);
+      }
+      history.undone();
+      return true;
+    }
+
+    bool redo()
+    {
+      endAllDrags();
+      const UndoHistory::Step *step = history.nextRedo();
+      if (!step)
+      {
+        return false;
+      }
+      for (const UndoHistory::Edit &edit : *step)
+      {
+        apply(edit, false);
+      }
+      history.redone();
+      return true;
+    }
+
+    // Plain rects for bulk adding, e.g. from an import
+    struct Batch
+    {
+      std::vector<int> xs, ys, ws, hs;
+      std::vector<SDL_Color> colors;
+
+      size_t size() const { return xs.size(); }
+
+      void clear()
+      {
+        xs.clear();
+        ys.clear();
+        ws.clear();
+        hs.clear();
+        colors.clear();
+      }
+    };
+
+    // Appends a batch to the columns without indexing it; the new objects
+    // are invisible to queries until indexFrom() is called. Not journaled.
+    void appendBatch(const Batch &batch)
+    {
+      size_t count = batch.size();
+      xs.append(batch.xs.data(), count);
+      ys.append(batch.ys.data(), count);
+      ws.append(batch.ws.data(), count);
+      hs.append(batch.hs.data(), count);
+      colors.append(batch.colors.data(), count);
+      constexpr size_t STEP = 1024;
+      static const Uint32 noImages[STEP] = {};
+      static const Uint8 unselected[STEP] = {};
+      Uint32 newZs[STEP];
+      Uint64 newIds[STEP];
+      for (size_t done = 0; done < count;)
+      {
+        size_t n = std::min(STEP, count - done);
+        for (size_t i = 0; i < n; ++i)
+        {
+          newZs[i] = nextZ++;
+          newIds[i] = nextId++;
+        }
+        images.append(noImages, n);
+        zs.append(newZs, n);
+        selected.append(unselected, n);
+        ids.append(newIds, n);
+        done += n;
+      }
+    }
+
+    // Builds the grid and LOD entries of the slots appended from first on,
+    // and records them as one undoable add
+    void indexFrom(size_t first)
+    {
+      grid.insertRange(first, size() - first,
+                       [this](size_t slot) { return getRect(slot); });
+      UndoHistory::Edit added(UndoHistory::Kind::Add, {});
+      for (size_t slot = first; slot < size(); ++slot)
+      {
+        lod.add(getRect(slot), colors[slot]);
+        added.addSlot(slot);
+      }
+      history.push({std::move(added)});
+      damageAll = true;
+    }
+
+    size_t size() const { return xs.size(); }
+
+    bool containsPoint(size_t slot, int x, int y) const
+    {
+      return x >= xs[slot] && x < xs[slot] + ws[slot] && y >= ys[slot] &&
+             y < ys[slot] + hs[slot];
+    }
+
+    // Returns the topmost object under the point, or size() if none
+    size_t hitTest(int x, int y) const
+    {
+      size_t hit = size();
+      grid.query(SDL_Rect{x, y, 1, 1}, [&](size_t slot) {
+        if (containsPoint(slot, x, y) && (hit == size() || zs[slot] > zs[hit]))
+        {
+          hit = slot;
+        }
+      });
+      return hit;
+    }
+
+    // Collects the objects overlapping a world area, bottom to top
+    void query(const SDL_Rect &area, std::vector<size_t> &out) const
+    {
+      out.clear();
+      grid.query(area, [&](size_t slot) {
+        if (xs[slot] < area.x + area.w && xs[slot] + ws[slot] > area.x &&
+            ys[slot] < area.y + area.h && ys[slot] + hs[slot] > area.y)
+        {
+          out.push_back(slot);
+        }
+      });
+      sortByZ(out);
+    }
+
+    // Appends the objects whose center lies in a world area and that
+    // overlap view, unsorted. Used per LOD tile so every object is
+    // reported by exactly one tile.
+    void collectCentered(const SDL_Rect &area, const SDL_Rect &view,
+                         std::vector<size_t> &out) const
+    {
+      grid.query(area, [&](size_t slot) {
+        int cx = xs[slot] + ws[slot] / 2;
+        int cy = ys[slot] + hs[slot] / 2;
+        if (cx >= area.x && cx < area.x + area.w && cy >= area.y &&
+            cy < area.y + area.h && xs[slot] < view.x + view.w &&
+            xs[slot] + ws[slot] > view.x && ys[slot] < view.y + view.h &&
+            ys[slot] + hs[slot] > view.y)
+        {
+          out.push_back(slot);
+        }
+      });
+    }
+
+    void sortByZ(std::vector<size_t> &slots) const
+    {
+      std::sort(slots.begin(), slots.end(),
+                [this](size_t a, size_t b) { return zs[a] < zs[b]; });
+    }
+
+    const LodTiles &getLod() const { return lod; }
+
+    void clearSelection()
+    {
+      for (size_t slot = 0; slot < size(); ++slot)
+      {
+        if (selected[slot])
+        {
+          selected.set(slot, 0);
+          markDamaged(getRect(slot));
+        }
+      }
+    }
+
+    void selectAll()
+    {
+      selected.fill(1);
+      damageAll = true;
+    }
+
+    void toggleSelected(size_t slot)
+    {
+      selected.set(slot, !selected[slot]);
+      markDamaged(getRect(slot));
+    }
+
+    // Gives every selected object a new random color
+    void recolorSelected()
+    {
+      UndoHistory::Edit edit(UndoHistory::Kind::Recolor, {});
+      for (size_t slot = 0; slot < size(); ++slot)
+      {
+        if (selected[slot] && !isDeleted(slot))
+        {
+          edit.addSlot(slot);
+          edit.values.push_back(packColor(colors[slot]));
+          setColor(slot, generateRandomColor());
+          edit.values.push_back(packColor(colors[slot]));
+          log(SceneJournal::Op::Recolor, slot);
+        }
+      }
+      if (!edit.runs.empty())
+      {
+        history.push({std::move(edit)});
+      }
+    }
+
+    void deleteSelected()
+    {
+      UndoHistory::Edit edit(UndoHistory::Kind::Delete, {});
+      for (size_t slot = 0; slot < size(); ++slot)
+      {
+        if (selected[slot] && !isDeleted(slot))
+        {
+          edit.addSlot(slot);
+          remove(slot);
+          log(SceneJournal::Op::Delete, slot);
+        }
+      }
+      if (!edit.runs.empty())
+      {
+        history.push({std::move(edit)});
+      }
+    }
+
+    bool isDeleted(size_t slot) const
+    {
+      return slot < deleted.size() && deleted[slot] != 0;
+    }
+
+    // Moves the given objects to the front, keeping their relative order.
+    // Returns the undo record.
+    UndoHistory::Edit raise(std::vector<size_t> &slots)
+    {
+      std::vector<size_t> bySlot = slots;
+      std::sort(bySlot.begin(), bySlot.end());
+      UndoHistory::Edit edit(UndoHistory::Kind::Raise, bySlot);
+      edit.firstZ = nextZ;
+      for (size_t slot : bySlot)
+      {
+        edit.values.push_back(zs[slot]);
+      }
+
+      std::sort(slots.begin(), slots.end(),
+                [this](size_t a, size_t b) { return zs[a] < zs[b]; });
+      for (size_t slot : slots)
+      {
+        zs.set(slot, nextZ++);
+        markDamaged(getRect(slot));
+        log(SceneJournal::Op::Raise, slot);
+      }
+      return edit;
+    }
+
+    void beginDrag(PointerId pointer, std::vector<size_t> slots, int x,
+                   int y)
+    {
+      endDrag(pointer);
+      UndoHistory::Edit raised = raise(slots);
+
+      DragSession &session = sessions[pointer];
+      session.step.push_back(std::move(raised));
+      session.token = nextSessionToken++;
+      session.slots = std::move(slots);
+      size_t count = session.slots.size();
+      session.startX.resize(count);
+      session.startY.resize(count);
+      session.limitX.resize(count);
+      session.limitY.resize(count);
+      session.outX.resize(count);
+      session.outY.resize(count);
+      dragOwner.resize(size());
+      dragOrigin.resize(size());
+      for (size_t i = 0; i < count; ++i)
+      {
+        size_t slot = session.slots[i];
+        if (dragOwner[slot] != 0)
+        {
+          ++stolenCount;
+        }
+        else
+        {
+          dragOrigin[slot] = SDL_Point{xs[slot], ys[slot]};
+        }
+        dragOwner[slot] = session.token;
+        session.startX[i] = xs[slot];
+        session.startY[i] = ys[slot];
+        // Keep within world bounds
+        session.limitX[i] = WORLD_WIDTH - ws[slot];
+        session.limitY[i] = WORLD_HEIGHT - hs[slot];
+      }
+      session.anchorX = x;
+      session.anchorY = y;
+      session.pointerX = x;
+      session.pointerY = y;
+    }
+
+    void updateDrag(PointerId pointer, int x, int y)
+    {
+      auto it = sessions.find(pointer);
+      if (it == sessions.end())
+      {
+        return;
+      }
+      DragSession &session = it->second;
+      session.pointerX = x;
+      session.pointerY = y;
+      size_t count = session.slots.size();
+      translateClamped(session.startX.data(), session.limitX.data(),
+                       session.outX.data(), count, x - session.anchorX);
+      translateClamped(session.startY.data(), session.limitY.data(),
+                       session.outY.data(), count, y - session.anchorY);
+      // One pass writes the new coordinates and relinks the objects whose
+      // grid cells or LOD tile changed; the damage is one union rect
+      SDL_Rect area{0, 0, 0, 0};
+      bool moved = false;
+      auto extend = [&](const SDL_Rect &rect)
+      {
+        if (moved)
+        {
+          SDL_UnionRect(&area, &rect, &area);
+        }
+        else
+        {
+          area = rect;
+          moved = true;
+        }
+      };
+      for (size_t i = 0; i < count; ++i)
+      {
+        size_t slot = session.slots[i];
+        if (dragOwner[slot] != session.token ||
+            (xs[slot] == session.outX[i] && ys[slot] == session.outY[i]))
+        {
+          continue;
+        }
+        SDL_Rect before = getRect(slot);
+        xs.set(slot, session.outX[i]);
+        ys.set(slot, session.outY[i]);
+        SDL_Rect after = getRect(slot);
+        grid.update(slot, after);
+        if (lod.move(before, after, colors[slot]))
+        {
+          extend(LodTiles::tileArea(before));
+          extend(LodTiles::tileArea(after));
+        }
+        extend(before);
+        extend(after);
+      }
+      if (moved)
+      {
+        markDamaged(area);
+      }
+    }
+
+    void endDrag(PointerId pointer)
+    {
+      auto it = sessions.find(pointer);
+      if (it == sessions.end())
+      {
+        return;
+      }
+      // Only where the objects end up is journaled and kept for undo, not
+      // every motion. An object taken over from another drag counts from
+      // where that drag grabbed it.
+      DragSession &session = it->second;
+      std::vector<size_t> owned;
+      for (size_t slot : session.slots)
+      {
+        if (dragOwner[slot] == session.token)
+        {
+          dragOwner[slot] = 0;
+          owned.push_back(slot);
+          log(SceneJournal::Op::Move, slot);
+        }
+      }
+      std::sort(owned.begin(), owned.end());
+      UndoHistory::Edit moved(UndoHistory::Kind::Move, owned);
+      moved.dx = session.pointerX - session.anchorX;
+      moved.dy = session.pointerY - session.anchorY;
+      bool any = false;
+      for (size_t slot : owned)
+      {
+        int dx = xs[slot] - dragOrigin[slot].x;
+        int dy = ys[slot] - dragOrigin[slot].y;
+        any = any || dx != 0 || dy != 0;
+        if (dx != moved.dx || dy != moved.dy)
+        {
+          moved.values.insert(moved.values.end(),
+                              {Uint32(slot), Uint32(dx), Uint32(dy)});
+        }
+      }
+      if (any)
+      {
+        session.step.push_back(std::move(moved));
+      }
+      history.push(std::move(session.step));
+      sessions.erase(it);
+    }
+
+    void endAllDrags()
+    {
+      while (!sessions.empty())
+      {
+        endDrag(sessions.begin()->first);
+      }
+    }
+
+    // Starts a drag on whatever is under the pointer. A selected object
+    // drags the whole selection; the mouse also makes an unselected object
+    // the new selection, while fingers leave the selection alone so several
+    // of them can move separate objects.
+    void pointerDown(PointerId pointer, int x, int y, bool fromMouse)
+    {
+      bool toggle = fromMouse && (SDL_GetModState() & KMOD_CTRL) != 0;
+      size_t hit = hitTest(x, y);
+      if (hit != size())
+      {
+        if (toggle)
+        {
+          toggleSelected(hit);
+          return;
+        }
+        std::vector<size_t> slots;
+        if (selected[hit])
+        {
+          for (size_t slot = 0; slot < size(); ++slot)
+          {
+            if (selected[slot] && !isDeleted(slot))
+            {
+              slots.push_back(slot);
+            }
+          }
+        }
+        else
+        {
+          if (fromMouse)
+          {
+            clearSelection();
+            toggleSelected(hit);
+          }
+          slots.push_back(hit);
+        }
+        beginDrag(pointer, std::move(slots), x, y);
+        return;
+      }
+      // If no object was clicked, create a new one
+      if (!toggle)
+      {
+        clearSelection();
+      }
+      addObject(x, y);
+    }
+
+    size_t activeDragCount() const { return sessions.size(); }
+
+    // Calls visit(pointer, worldX, worldY) for every active drag
+    template <typename Visit> void forEachDragPointer(Visit &&visit) const
+    {
+      for (const auto &[pointer, session] : sessions)
+      {
+        visit(pointer, session.pointerX, session.pointerY);
+      }
+    }
+
+    // Objects grabbed while another pointer was already dragging them
+    size_t stolenDragCount() const { return stolenCount; }
+
+    SDL_Rect getRect(size_t slot) const
+    {
+      return SDL_Rect{xs[slot], ys[slot], ws[slot], hs[slot]};
+    }
+
+    const SDL_Color &getColor(size_t slot) const { return colors[slot]; }
+
+    Uint32 getImage(size_t slot) const { return images[slot]; }
+
+    bool isSelected(size_t slot) const { return selected[slot] != 0; }
+
+    Uint64 getId(size_t slot) const { return ids[slot]; }
+
+    // Slot of an object id, or size() if there is none
+    size_t findSlot(Uint64 id) const
+    {
+      size_t low = 0;
+      size_t high = size();
+      while (low < high)
+      {
+        size_t middle = low + (high - low) / 2;
+        if (ids[middle] < id)
+        {
+          low = middle + 1;
+        }
+        else
+        {
+          high = middle;
+        }
+      }
+      return low < size() && ids[low] == id ? low : size();
+    }
+
+    // Logs every later edit to the journal, or stops logging if null
+    void setJournal(SceneJournal *target) { journal = target; }
+
+    // Redoes a journaled edit. Edits of deleted objects, and adds of live
+    // ones, change nothing; an add of a deleted object restores it, as
+    // undoing a delete does. loadImage queues an image path and returns
+    // its id.
+    void replay(const SceneJournal::Record &record, const std::string &image,
+                const std::function<Uint32(const std::string &)> &loadImage)
+    {
+      using Op = SceneJournal::Op;
+      if (record.op == Op::Add)
+      {
+        if (record.id >= nextId)
+        {
+          insert(SDL_Rect{record.x, record.y, record.w, record.h},
+                 record.color, image.empty() ? 0 : loadImage(image), record.z,
+                 record.id);
+          nextId = record.id + 1;
+          nextZ = std::max(nextZ, record.z + 1);
+          return;
+        }
+        size_t slot = findSlot(record.id);
+        if (slot != size() && isDeleted(slot))
+        {
+          xs.set(slot, record.x);
+          ys.set(slot, record.y);
+          zs.set(slot, record.z);
+          colors.set(slot, record.color);
+          nextZ = std::max(nextZ, record.z + 1);
+          restore(slot);
+        }
+        return;
+      }
+      size_t slot = findSlot(record.id);
+      if (slot == size() || isDeleted(slot))
+      {
+        return;
+      }
+      switch (record.op)
+      {
+      case Op::Move:
+        moveTo(slot, record.x, record.y);
+        break;
+      case Op::Raise:
+        zs.set(slot, record.z);
+        nextZ = std::max(nextZ, record.z + 1);
+        markDamaged(getRect(slot));
+        break;
+      case Op::Recolor:
+        setColor(slot, record.color);
+        break;
+      case Op::Delete:
+        remove(slot);
+        break;
+      default:
+        break;
+      }
+    }
+
+    // An immutable version of the saved part of the scene. Taking one is
+    // O(1), as each column shares its chunk table; later edits to the live
+    // scene copy the table and the chunks they touch instead of changing
+    // the snapshot, so any number of versions can be kept while the UI
+    // keeps editing.
+    struct Snapshot
+    {
+      Column<int> xs, ys, ws, hs;
+      Column<SDL_Color> colors;
+      Column<Uint32> zs;
+      Column<Uint8> selected;
+      Column<Uint32> images;
+      Column<Uint64> ids;
+      Uint32 nextZ;
+      Uint64 nextId;
+      Column<Uint8> deleted; // may be shorter than the rest
+    };
+
+    Snapshot snapshot() const
+    {
+      return Snapshot{xs,       ys,     ws,  hs,    colors, zs,
+                      selected, images, ids, nextZ, nextId, deleted};
+    }
+
+    // Writes a snapshot to a scene file, replacing path atomically. Image
+    // ids are stored as 1-based indices into the file's path table. Only
+    // reads the snapshot, so it may run on any thread.
+    static void save(const Snapshot &scene, const std::string &path,
+                     const std::function<std::string(Uint32)> &imagePath)
+    {
+      AtomicFile out(path);
+      writeScene(out, scene, imagePath);
+      out.commit();
+    }
+
+    // Writes a checkpoint: the scene plus the grid, LOD tiles and camera,
+    // so that resume() can skip rebuilding them. Blocks until it is on
+    // disk.
+    void checkpoint(const std::string &path,
+                    const std::function<std::string(Uint32)> &imagePath,
+                    const Camera &camera) const
+    {
+      AtomicFile out(path);
+      writeScene(out, snapshot(), imagePath);
+      out.align(SCENE_FILE_ALIGN);
+      Uint64 at = out.position();
+      CheckpointHeader header{};
+      std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+      header.gridCellSize = SpatialGrid::CELL_SIZE;
+      header.lodTileSize = LodTiles::TILE_SIZE;
+      header.cameraX = camera.x;
+      header.cameraY = camera.y;
+      header.cameraZoom = camera.zoom;
+      out.write(&header, sizeof(header)); // rewritten once complete
+
+      const auto &cells = grid.cellLists();
+      std::vector<Uint64> starts(cells.size() + 1);
+      for (size_t cell = 0; cell < cells.size(); ++cell)
+      {
+        starts[cell + 1] = starts[cell] + cells[cell].size();
+      }
+      header.startsOffset = out.position();
+      out.write(starts.data(), starts.size() * sizeof(Uint64));
+      header.slotsOffset = out.position();
+      header.slotCount = starts.back();
+      for (const std::vector<Uint32> &cell : cells)
+      {
+        out.write(cell.data(), cell.size() * sizeof(Uint32));
+      }
+      out.align(alignof(Uint64));
+      // Slots never inserted, e.g. loaded as tombstones, get empty spans
+      // in cell 0, so every slot has one
+      const auto &spans = grid.spanList();
+      header.spansOffset = out.position();
+      header.spanCount = size();
+      out.write(spans.data(), spans.size() * sizeof(SpatialGrid::Span));
+      const SpatialGrid::Span unused{0, 0, 0, 0};
+      for (size_t slot = spans.size(); slot < size(); ++slot)
+      {
+        out.write(&unused, sizeof(unused));
+      }
+      out.align(alignof(Uint64));
+      const auto &tiles = lod.tileList();
+      header.tilesOffset = out.position();
+      out.write(tiles.data(), tiles.size() * sizeof(LodTiles::Tile));
+      out.patch(at, &header, sizeof(header));
+      out.commit();
+    }
+
+  private:
+    // Follows the scene in a checkpoint, at the first aligned offset after
+    // the path table. Offsets are from the start of the file.
+    struct CheckpointHeader
+    {
+      char magic[8];
+      Uint32 gridCellSize; // must match this build's for the grid to fit
+      Uint32 lodTileSize;
+      double cameraX, cameraY, cameraZoom;
+      Uint64 startsOffset; // cells + 1 Uint64s, see SpatialGrid::restore
+      Uint64 slotsOffset;
+      Uint64 slotCount;
+      Uint64 spansOffset;
+      Uint64 spanCount;
+      Uint64 tilesOffset;
+    };
+    static constexpr char CHECKPOINT_MAGIC[8] = {'M', 'D', 'C', 'K', 'P',
+                                                 'T', 0,   0};
+
+    static void writeScene(AtomicFile &out, const Snapshot &scene,
+                           const std::function<std::string(Uint32)> &imagePath)
+    {
+      std::unordered_map<Uint32, Uint32> imageIndex;
+      std::string strings;
+      Column<Uint32> fileImages;
+      for (size_t slot = 0; slot < scene.images.size(); ++slot)
+      {
+        Uint32 image = scene.images[slot];
+        if (image != 0 && imageIndex.count(image) == 0)
+        {
+          strings += imagePath(image);
+          strings += '\0';
+          imageIndex.emplace(image, static_cast<Uint32>(imageIndex.size() + 1));
+        }
+        fileImages.push_back(image ? imageIndex[image] : 0);
+      }
+
+      SceneFileHeader header{};
+      std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+      header.version = SCENE_FILE_VERSION;
+      header.byteOrder = SCENE_BYTE_ORDER;
+      header.objectCount = scene.xs.size();
+      header.nextId = scene.nextId;
+      header.nextZ = scene.nextZ;
+
+      out.write(&header, sizeof(header)); // rewritten once complete
+      auto writeColumn = [&](SceneColumn id, const auto &column)
+      {
+        using T = typename std::decay_t<decltype(column)>::value_type;
+        out.align(SCENE_FILE_ALIGN);
+        SceneColumnEntry &entry = header.columns[header.columnCount++];
+        entry.column = static_cast<Uint32>(id);
+        entry.elementSize = sizeof(T);
+        entry.offset = out.position();
+        column.forEachChunk([&](const T *data, size_t count)
+                            { out.write(data, count * sizeof(T)); });
+        // A short column is padded with zeros
+        entry.size = sceneColumnBytes(header.objectCount, sizeof(T));
+        out.padTo(entry.offset + entry.size);
+      };
+      writeColumn(SceneColumn::X, scene.xs);
+      writeColumn(SceneColumn::Y, scene.ys);
+      writeColumn(SceneColumn::Width, scene.ws);
+      writeColumn(SceneColumn::Height, scene.hs);
+      writeColumn(SceneColumn::Color, scene.colors);
+      writeColumn(SceneColumn::Z, scene.zs);
+      writeColumn(SceneColumn::Selected, scene.selected);
+      writeColumn(SceneColumn::Image, fileImages);
+      writeColumn(SceneColumn::Id, scene.ids);
+      writeColumn(SceneColumn::Deleted, scene.deleted);
+      header.stringsOffset = out.position();
+      header.stringsSize = strings.size();
+      out.write(strings.data(), strings.size());
+      out.patch(0, &header, sizeof(header));
+    }
+
+    // Uses the columns of a mapped scene file in place of the current ones
+    // and forgets drags and history. The grid and LOD tiles are left to
+    // the caller.
+    void mapScene(const std::shared_ptr<MappedFile> &file,
+                  const std::string &path,
+                  const std::function<Uint32(const std::string &)> &loadImage)
+    {
+      const SceneFileHeader &header = sceneFileHeader(*file, path);
+      size_t count = static_cast<size_t>(header.objectCount);
+      auto mapColumn = [&](SceneColumn id, auto &column)
+      {
+        using T = typename std::decay_t<decltype(column)>::value_type;
+        const SceneColumnEntry *entry = findSceneColumn(header, id);
+        if (!entry || entry->elementSize != sizeof(T))
+        {
+          throw std::runtime_error(path + " lacks scene column " +
+                                   std::to_string(static_cast<Uint32>(id)));
+        }
+        column = Column<T>::mapped(
+            file, reinterpret_cast<T *>(file->data() + entry->offset), count);
+      };
+
+      std::vector<Uint32> imageIds;
+      const char *strings =
+          reinterpret_cast<const char *>(file->data() + header.stringsOffset);
+      for (size_t at = 0; at < header.stringsSize;)
+      {
+        const char *end = static_cast<const char *>(
+            std::memchr(strings + at, 0, header.stringsSize - at));
+        if (!end)
+        {
+          throw std::runtime_error(path + " is damaged");
+        }
+        imageIds.push_back(loadImage(std::string(strings + at, end)));
+        at = static_cast<size_t>(end - strings) + 1;
+      }
+
+      mapColumn(SceneColumn::X, xs);
+      mapColumn(SceneColumn::Y, ys);
+      mapColumn(SceneColumn::Width, ws);
+      mapColumn(SceneColumn::Height, hs);
+      mapColumn(SceneColumn::Color, colors);
+      mapColumn(SceneColumn::Z, zs);
+      mapColumn(SceneColumn::Selected, selected);
+      mapColumn(SceneColumn::Image, images);
+      mapColumn(SceneColumn::Id, ids);
+      deleted = Column<Uint8>();
+      if (findSceneColumn(header, SceneColumn::Deleted))
+      {
+        mapColumn(SceneColumn::Deleted, deleted);
+      }
+      nextZ = header.nextZ;
+      nextId = header.nextId;
+      sceneFile = file;
+
+      bool remap = false;
+      for (size_t i = 0; i < imageIds.size(); ++i)
+      {
+        remap = remap || imageIds[i] != i + 1;
+      }
+      for (size_t slot = 0; remap && slot < count; ++slot)
+      {
+        Uint32 image = images[slot];
+        if (image != 0)
+        {
+          images.set(slot, image <= imageIds.size() ? imageIds[image - 1] : 0);
+        }
+      }
+
+      sessions.clear();
+      dragOwner.clear();
+      dragOrigin.clear();
+      history.clear();
+      damage.clear();
+      damageAll = true;
+    }
+
+  public:
+    // Replaces the scene with a scene file whose columns are used in place
+    // from a private mapping, so only the pages touched are read. The
+    // spatial grid and LOD tiles are rebuilt, which reads the coordinates
+    // and colors. loadImage queues an image path and returns its id; the
+    // image column is only rewritten if those ids differ from the file's.
+    void load(const std::string &path,
+              const std::function<Uint32(const std::string &)> &loadImage)
+    {
+      mapScene(std::make_shared<MappedFile>(path), path, loadImage);
+      grid = SpatialGrid();
+      lod = LodTiles();
+      for (size_t slot = 0; slot < size(); ++slot)
+      {
+        if (!isDeleted(slot))
+        {
+          SDL_Rect rect = getRect(slot);
+          grid.insert(slot, rect);
+          lod.add(rect, colors[slot]);
+        }
+      }
+    }
+
+    // Like load() for a file written by checkpoint(), but copies the grid
+    // and LOD tiles from it instead of rebuilding them, so the columns are
+    // not read. Also restores the camera. Returns false, changing nothing,
+    // if the file holds no checkpoint this build can use.
+    bool resume(const std::string &path,
+                const std::function<Uint32(const std::string &)> &loadImage,
+                Camera &camera)
+    {
+      auto file = std::make_shared<MappedFile>(path);
+      const SceneFileHeader &scene = sceneFileHeader(*file, path);
+      Uint64 at = (scene.stringsOffset + scene.stringsSize +
+                   SCENE_FILE_ALIGN - 1) / SCENE_FILE_ALIGN * SCENE_FILE_ALIGN;
+      if (at > file->size() || file->size() - at < sizeof(CheckpointHeader))
+      {
+        return false;
+      }
+      const CheckpointHeader &header =
+          *reinterpret_cast<const CheckpointHeader *>(file->data() + at);
+      if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) !=
+              0 ||
+          header.gridCellSize != SpatialGrid::CELL_SIZE ||
+          header.lodTileSize != LodTiles::TILE_SIZE)
+      {
+        return false;
+      }
+      // Every section must lie within the file, and the slots within the
+      // spans
+      size_t cellCount = grid.cellLists().size();
+      auto fits = [&](Uint64 offset, Uint64 count, size_t elementSize)
+      {
+        return offset % alignof(Uint64) == 0 && offset <= file->size() &&
+               count <= (file->size() - offset) / elementSize;
+      };
+      const Uint8 *data = file->data();
+      if (!fits(header.startsOffset, cellCount + 1, sizeof(Uint64)) ||
+          !fits(header.slotsOffset, header.slotCount, sizeof(Uint32)) ||
+          !fits(header.spansOffset, header.spanCount,
+                sizeof(SpatialGrid::Span)) ||
+          !fits(header.tilesOffset, lod.tileList().size(),
+                sizeof(LodTiles::Tile)) ||
+          header.spanCount != scene.objectCount)
+      {
+        throw std::runtime_error(path + " is damaged");
+      }
+      auto starts = reinterpret_cast<const Uint64 *>(data + header.startsOffset);
+      auto slots = reinterpret_cast<const Uint32 *>(data + header.slotsOffset);
+      auto spans = reinterpret_cast<const SpatialGrid::Span *>(
+          data + header.spansOffset);
+      if (std::any_of(spans, spans + header.spanCount,
+                      [](const SpatialGrid::Span &span)
+                      {
+                        return span.x0 < 0 || span.x0 > span.x1 ||
+                               span.x1 >= SpatialGrid::COLUMNS ||
+                               span.y0 < 0 || span.y0 > span.y1 ||
+                               span.y1 >= SpatialGrid::ROWS;
+                      }))
+      {
+        throw std::runtime_error(path + " is damaged");
+      }
+      if (starts[0] != 0 || starts[cellCount] != header.slotCount)
+      {
+        throw std::runtime_error(path + " is damaged");
+      }
+      // Every live slot must be linked into exactly the cells of its span
+      // and tombstones into none, or later updates would unlink slots from
+      // cells that lack them
+      const SceneColumnEntry *deletedEntry =
+          findSceneColumn(scene, SceneColumn::Deleted);
+      const Uint8 *tombstones =
+          deletedEntry && deletedEntry->elementSize == 1
+              ? data + deletedEntry->offset
+              : nullptr;
+      std::vector<Uint32> links(static_cast<size_t>(header.spanCount));
+      for (size_t cell = 0; cell < cellCount; ++cell)
+      {
+        if (starts[cell] > starts[cell + 1])
+        {
+          throw std::runtime_error(path + " is damaged");
+        }
+        int cx = static_cast<int>(cell % SpatialGrid::COLUMNS);
+        int cy = static_cast<int>(cell / SpatialGrid::COLUMNS);
+        for (Uint64 i = starts[cell]; i < starts[cell + 1]; ++i)
+        {
+          Uint32 slot = slots[i];
+          if (slot >= header.spanCount || cx < spans[slot].x0 ||
+              cx > spans[slot].x1 || cy < spans[slot].y0 ||
+              cy > spans[slot].y1)
+          {
+            throw std::runtime_error(path + " is damaged");
+          }
+          ++links[slot];
+        }
+      }
+      for (size_t slot = 0; slot < links.size(); ++slot)
+      {
+        const SpatialGrid::Span &span = spans[slot];
+        Uint32 area = static_cast<Uint32>((span.x1 - span.x0 + 1) *
+                                          (span.y1 - span.y0 + 1));
+        if (links[slot] != (tombstones && tombstones[slot] ? 0 : area))
+        {
+          throw std::runtime_error(path + " is damaged");
+        }
+      }
+
+      mapScene(file, path, loadImage);
+      grid.restore(starts, slots, spans, static_cast<size_t>(header.spanCount));
+      lod.restore(
+          reinterpret_cast<const LodTiles::Tile *>(data + header.tilesOffset));
+      for (size_t slot = 0; slot < size(); ++slot)
+      {
+        if (!isDeleted(slot))
+        {
+          lod.extend(getRect(slot));
+        }
+      }
+      camera.x = header.cameraX;
+      camera.y = header.cameraY;
+      camera.zoom = std::clamp(header.cameraZoom, Camera::MIN_ZOOM,
+                               Camera::MAX_ZOOM);
+      return true;
+    }
+
+    // Hands over the world areas changed since the last call. Returns true
+    // when the whole scene should be treated as changed instead.
+    bool takeDamage(std::vector<SDL_Rect> &out)
+    {
+      bool all = damageAll;
+      out.swap(damage);
+      damage.clear();
+      damageAll = false;
+      return all;
+    }
+  };
+
+  // Writes a snapshot as SVG or CSV, bottom to top. Text is formatted by
+  // hand with std::to_chars into a fixed buffer that is handed to the file
+  // in large writes. The CSV has the importer's "x,y,w,h,rrggbbaa" lines;
+  // the SVG draws image objects as <image> elements linking their BMPs.
+  class SceneExporter
+  {
+  private:
+    class Writer
+    {
+    private:
+      static constexpr size_t BUFFER_SIZE = 1 << 20;
+      static constexpr size_t MAX_PUT = 64; // longest single put
+      AtomicFile &out;
+      std::vector<char> buffer;
+      size_t used = 0;
+
+    public:
+      explicit Writer(AtomicFile &file) : out(file), buffer(BUFFER_SIZE) {}
+
+      void flush()
+      {
+        out.write(buffer.data(), used);
+        used = 0;
+      }
+
+      void text(const char *data, size_t size)
+      {
+        if (used + size > BUFFER_SIZE)
+        {
+          flush();
+        }
+        if (size > BUFFER_SIZE)
+        {
+          out.write(data, size);
+          return;
+        }
+        std::memcpy(buffer.data() + used, data, size);
+        used += size;
+      }
+
+      template <size_t N> void text(const char (&literal)[N])
+      {
+        text(literal, N - 1);
+      }
+
+      void number(long long value)
+      {
+        if (used + MAX_PUT > BUFFER_SIZE)
+        {
+          flush();
+        }
+        char *at = buffer.data() + used;
+        used += std::to_chars(at, at + MAX_PUT, value).ptr - at;
+      }
+
+      // Two lowercase hex digits per byte
+      void hex(const Uint8 *bytes, size_t count)
+      {
+        static const char DIGITS[] = "0123456789abcdef";
+        if (used + 2 * count > BUFFER_SIZE)
+        {
+          flush();
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+          buffer[used++] = DIGITS[bytes[i] >> 4];
+          buffer[used++] = DIGITS[bytes[i] & 15];
+        }
+      }
+
+      // Text escaped for an XML attribute
+      void attribute(const std::string &value)
+      {
+        for (char c : value)
+        {
+          switch (c)
+          {
+          case '&':
+            text("&amp;");
+            break;
+          case '<':
+            text("&lt;");
+            break;
+          case '"':
+            text("&quot;");
+            break;
+          default:
+            text(&c, 1);
+          }
+        }
+      }
+    };
+
+    // Live slots of the snapshot, bottom to top
+    static std::vector<Uint32>
+    stackingOrder(const ObjectManager::Snapshot &scene)
+    {
+      std::vector<Uint32> order;
+      order.reserve(scene.xs.size());
+      for (size_t slot = 0; slot < scene.xs.size(); ++slot)
+      {
+        if (slot >= scene.deleted.size() || !scene.deleted[slot])
+        {
+          order.push_back(static_cast<Uint32>(slot));
+        }
+      }
+      std::sort(order.begin(), order.end(), [&](Uint32 a, Uint32 b)
+                { return scene.zs[a] < scene.zs[b]; });
+      return order;
+    }
+
+    static void writeCsv(const ObjectManager::Snapshot &scene,
+                         const std::vector<Uint32> &order, Writer &out)
+    {
+      out.text("x,y,w,h,rgba\n");
+      for (Uint32 slot : order)
+      {
+        const SDL_Color &color = scene.colors[slot];
+        const Uint8 rgba[4] = {color.r, color.g, color.b, color.a};
+        out.number(scene.xs[slot]);
+        out.text(",");
+        out.number(scene.ys[slot]);
+        out.text(",");
+        out.number(scene.ws[slot]);
+        out.text(",");
+        out.number(scene.hs[slot]);
+        out.text(",");
+        out.hex(rgba, 4);
+        out.text("\n");
+      }
+    }
+
+    static void writeSvg(const ObjectManager::Snapshot &scene,
+                         const std::vector<Uint32> &order,
+                         const std::vector<std::string> &imagePaths,
+                         Writer &out)
+    {
+      out.text("<svg xmlns=\"http://www.w3.org/2000/svg\" "
+               "xmlns:xlink=\"http://www.w3.org/1999/xlink\" viewBox=\"0 0 ");
+      out.number(WORLD_WIDTH);
+      out.text(" ");
+      out.number(WORLD_HEIGHT);
+      out.text("\">\n");
+      for (Uint32 slot : order)
+      {
+        Uint32 image = scene.images[slot];
+        bool linked = image != 0 && image <= imagePaths.size();
+        if (linked)
+        {
+          out.text("<image x=\"");
+        }
+        else
+        {
+          out.text("<rect x=\"");
+        }
+        out.number(scene.xs[slot]);
+        out.text("\" y=\"");
+        out.number(scene.ys[slot]);
+        out.text("\" width=\"");
+        out.number(scene.ws[slot]);
+        out.text("\" height=\"");
+        out.number(scene.hs[slot]);
+        if (linked)
+        {
+          out.text("\" preserveAspectRatio=\"none\" xlink:href=\"");
+          out.attribute(imagePaths[image - 1]);
+          out.text("\"/>\n");
+          continue;
+        }
+        const SDL_Color &color = scene.colors[slot];
+        const Uint8 rgb[3] = {color.r, color.g, color.b};
+        out.text("\" fill=\"#");
+        out.hex(rgb, 3);
+        if (color.a != 255)
+        {
+          out.text("\" fill-opacity=\"0.");
+          int opacity = color.a * 1000 / 255;
+          const char digits[3] = {char('0' + opacity / 100),
+                                  char('0' + opacity / 10 % 10),
+                                  char('0' + opacity % 10)};
+          out.text(digits, 3);
+        }
+        out.text("\"/>\n");
+      }
+      out.text("</svg>\n");
+    }
+
+  public:
+    // The format follows the extension: .svg, otherwise CSV. Replaces path
+    // atomically. Only reads the snapshot, so it may run on any thread.
+    static size_t write(const ObjectManager::Snapshot &scene,
+                        const std::string &path,
+                        const std::vector<std::string> &imagePaths)
+    {
+      std::vector<Uint32> order = stackingOrder(scene);
+      AtomicFile file(path);
+      Writer out(file);
+      std::string extension = std::filesystem::path(path).extension().string();
+      std::transform(extension.begin(), extension.end(), extension.begin(),
+                     [](char c) { return char(std::tolower(Uint8(c))); });
+      if (extension == ".svg")
+      {
+        writeSvg(scene, order, imagePaths, out);
+      }
+      else
+      {
+        writeCsv(scene, order, out);
+      }
+      out.flush();
+      file.commit();
+      return order.size();
+    }
+  };
+
+  // Writes scene snapshots on a background thread, so saving and exporting
+  // never hold up input or rendering. Jobs run in order, but a queued job
+  // is replaced by a newer one for the same file: only the newest snapshot
+  // is written, and runs the onSaved callbacks of the saves it replaces
+  // too. Finished jobs are reported through poll().
+  class SceneSaver
+  {
+  public:
+    struct Report
+    {
+      bool ok;
+      std::string message;
+    };
+
+  private:
+    struct Job
+    {
+      ObjectManager::Snapshot scene;
+      std::string path;
+      std::vector<std::string> imagePaths; // by image id - 1
+      std::vector<std::function<void()>> onSaved;
+      bool exported; // through SceneExporter instead of as a scene file
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::unique_ptr<Job>> queue;
+    bool writing = false;
+    bool stopping = false;
+    std::vector<Report> reports;
+    std::thread thread; // last, so it starts after the rest is set up
+
+    void writerLoop()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true)
+      {
+        wake.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty())
+        {
+          return;
+        }
+        std::unique_ptr<Job> job = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+        lock.unlock();
+
+        Report report{true, ""};
+        try
+        {
+          if (job->exported)
+          {
+            size_t count =
+                SceneExporter::write(job->scene, job->path, job->imagePaths);
+            report.message = "Exported " + std::to_string(count) +
+                             " objects to " + job->path;
+          }
+          else
+          {
+            ObjectManager::save(job->scene, job->path, [&](Uint32 image)
+                                { return job->imagePaths[image - 1]; });
+            report.message = "Saved " + std::to_string(job->scene.xs.size()) +
+                             " objects to " + job->path;
+          }
+          for (const std::function<void()> &done : job->onSaved)
+          {
+            done();
+          }
+        }
+        catch (const std::exception &e)
+        {
+          report = Report{false, e.what()};
+        }
+        job.reset(); // lets the live scene write its chunks in place again
+
+        lock.lock();
+        writing = false;
+        reports.push_back(report);
+        wake.notify_all();
+      }
+    }
+
+    void enqueue(std::unique_ptr<Job> job)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto queued = std::find_if(
+            queue.begin(), queue.end(), [&](const std::unique_ptr<Job> &other)
+            { return other->path == job->path; });
+        if (queued == queue.end())
+        {
+          queue.push_back(std::move(job));
+        }
+        else
+        {
+          job->onSaved.insert(job->onSaved.end(), (*queued)->onSaved.begin(),
+                              (*queued)->onSaved.end());
+          *queued = std::move(job);
+        }
+      }
+      wake.notify_all();
+    }
+
+  public:
+    SceneSaver() : thread([this] { writerLoop(); }) {}
+
+    // Writes whatever is still queued before returning
+    ~SceneSaver()
+    {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+      }
+      wake.notify_all();
+      thread.join();
+    }
+
+    // onSaved, if set, runs on the writer thread once the file is on disk
+    void save(ObjectManager::Snapshot scene, const std::string &path,
+              std::vector<std::string> imagePaths,
+              std::function<void()> onSaved = {})
+    {
+      auto job = std::make_unique<Job>(
+          Job{std::move(scene), path, std::move(imagePaths), {}, false});
+      if (onSaved)
+      {
+        job->onSaved.push_back(std::move(onSaved));
+      }
+      enqueue(std::move(job));
+    }
+
+    // Writes the snapshot as SVG or CSV, see SceneExporter
+    void exportTo(ObjectManager::Snapshot scene, const std::string &path,
+                  std::vector<std::string> imagePaths)
+    {
+      enqueue(std::make_unique<Job>(
+          Job{std::move(scene), path, std::move(imagePaths), {}, true}));
+    }
+
+    // Blocks until every queued job is written
+    void wait()
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return !writing && queue.empty(); });
+    }
+
+    // Outcomes of the saves finished since the last call
+    std::vector<Report> poll()
+    {
+      std::vector<Report> out;
+      std::lock_guard<std::mutex> lock(mutex);
+      out.swap(reports);
+      return out;
+    }
+  };
+
+#if !defined(_WIN32)
+  // Publishes the scene in a POSIX shared memory segment laid out as
+  // scene_share.h describes, for other processes to read in place. The
+  // snapshot published last is kept, so a publish finds the chunks written
+  // since by comparing chunk identity with it and copies only those; while
+  // nothing changed it costs a few pointer compares per chunk.
+  class SharedScene
+  {
+  private:
+    std::string name;
+    int fd = -1;
+    Uint8 *bytes = nullptr;
+    size_t length = 0;
+    ObjectManager::Snapshot last{};
+    bool published = false;
+
+    SharedSceneHeader &header()
+    {
+      return *reinterpret_cast<SharedSceneHeader *>(bytes);
+    }
+
+    void resize(size_t size)
+    {
+      if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+      {
+        throw std::runtime_error("Cannot resize shared scene " + name);
+      }
+      if (bytes)
+      {
+        munmap(bytes, length);
+      }
+      void *view =
+          mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (view == MAP_FAILED)
+      {
+        bytes = nullptr;
+        throw std::runtime_error("Cannot map shared scene " + name);
+      }
+      bytes = static_cast<Uint8 *>(view);
+      length = size;
+    }
+
+    // Room for at least count objects, in whole chunks; moves the columns
+    void grow(size_t count)
+    {
+      Uint64 capacity = std::max<Uint64>(header().capacity * 2,
+                                         sceneColumnBytes(count, 1));
+      Uint64 offsets[SHARED_COLUMN_COUNT];
+      resize(static_cast<size_t>(sharedSceneLayout(capacity, offsets)));
+      std::copy_n(offsets, SHARED_COLUMN_COUNT, header().columns);
+      header().capacity = capacity;
+    }
+
+    template <typename T>
+    static bool changed(const Column<T> &now, const Column<T> &before)
+    {
+      if (now.size() != before.size())
+      {
+        return true;
+      }
+      for (size_t chunk = 0; chunk * Column<T>::CHUNK_SIZE < now.size();
+           ++chunk)
+      {
+        if (!now.sharesChunk(before, chunk))
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Copies the chunks not shared with before; with all, every chunk.
+    // What lies past the column's end is zeroed, as a short column reads
+    // as zeros.
+    template <typename T>
+    void copy(SharedColumn column, const Column<T> &now,
+              const Column<T> &before, bool all)
+    {
+      T *out = reinterpret_cast<T *>(bytes + header().columns[column]);
+      size_t chunk = 0;
+      now.forEachChunk([&](const T *data, size_t count) {
+        if (all || !now.sharesChunk(before, chunk))
+        {
+          std::copy_n(data, count, out + chunk * Column<T>::CHUNK_SIZE);
+        }
+        ++chunk;
+      });
+      size_t end = all ? static_cast<size_t>(header().capacity)
+                       : std::max(now.size(), before.size());
+      std::fill(out + now.size(), out + end, T{});
+    }
+
+  public:
+    explicit SharedScene(const std::string &segmentName) : name(segmentName)
+    {
+      // A segment left by a run that crashed is replaced
+      fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      if (fd < 0 && errno == EEXIST && shm_unlink(name.c_str()) == 0)
+      {
+        fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+      }
+      if (fd < 0)
+      {
+        throw std::runtime_error("Cannot create shared scene " + name);
+      }
+      try
+      {
+        Uint64 offsets[SHARED_COLUMN_COUNT];
+        resize(static_cast<size_t>(sharedSceneLayout(0, offsets)));
+      }
+      catch (...)
+      {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw;
+      }
+      SharedSceneHeader &shared = header();
+      shared.version = SHARED_SCENE_VERSION;
+      shared.headerSize = sizeof(SharedSceneHeader);
+      sharedSceneLayout(0, shared.columns);
+      std::atomic_thread_fence(std::memory_order_release);
+      std::memcpy(shared.magic, SHARED_SCENE_MAGIC, sizeof(shared.magic));
+    }
+
+    // Readers keep their mappings; new ones can no longer open the name
+    ~SharedScene()
+    {
+      if (bytes)
+      {
+        munmap(bytes, length);
+      }
+      close(fd);
+      shm_unlink(name.c_str());
+    }
+
+    SharedScene(const SharedScene &) = delete;
+    SharedScene &operator=(const SharedScene &) = delete;
+
+    void publish(const ObjectManager::Snapshot &scene)
+    {
+      size_t count = scene.xs.size();
+      bool all = !published || count > header().capacity;
+      if (!all && !changed(scene.xs, last.xs) && !changed(scene.ys, last.ys) &&
+          !changed(scene.ws, last.ws) && !changed(scene.hs, last.hs) &&
+          !changed(scene.colors, last.colors) && !changed(scene.zs, last.zs) &&
+          !changed(scene.selected, last.selected) &&
+          !changed(scene.deleted, last.deleted) &&
+          !changed(scene.ids, last.ids))
+      {
+        return;
+      }
+      Uint64 begin = header().sequence.load(std::memory_order_relaxed);
+      header().sequence.store(begin + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      if (count > header().capacity)
+      {
+        grow(count);
+      }
+      copy(SHARED_X, scene.xs, last.xs, all);
+      copy(SHARED_Y, scene.ys, last.ys, all);
+      copy(SHARED_WIDTH, scene.ws, last.ws, all);
+      copy(SHARED_HEIGHT, scene.hs, last.hs, all);
+      copy(SHARED_COLOR, scene.colors, last.colors, all);
+      copy(SHARED_Z, scene.zs, last.zs, all);
+      copy(SHARED_SELECTED, scene.selected, last.selected, all);
+      copy(SHARED_DELETED, scene.deleted, last.deleted, all);
+      copy(SHARED_ID, scene.ids, last.ids, all);
+      header().objectCount = count;
+      ++header().epoch;
+      header().sequence.store(begin + 2, std::memory_order_release);
+      last = scene;
+      published = true;
+    }
+  };
+#endif
+
+  // Reads rects from CSV lines "x,y,w,h,rgba", with rgba in hex
+  // (rrggbbaa, optionally prefixed by # or 0x), or "x,y,w,h,r,g,b[,a]" in
+  // decimal. A first line that does not parse is taken as a header. The
+  // file is split into byte ranges parsed in parallel, each streamed
+  // through a fixed buffer; a range owns the lines starting inside it.
+  // Ranges are parsed a wave at a time and appended in file order, so
+  // memory stays bounded, and the index is built once at the end.
+  class CsvImporter
+  {
+  public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20; // also the longest line
+    static constexpr Uint64 RANGE_SIZE = 32 << 20;
+
+  private:
+    struct Range
+    {
+      Uint64 begin = 0;
+      Uint64 end = 0;
+      std::vector<char> buffer;
+      ObjectManager::Batch batch;
+      std::string error;
+    };
+
+    static bool parseInt(const char *first, const char *last, int &value,
+                         int base = 10)
+    {
+      while (first < last && *first == ' ')
+      {
+        ++first;
+      }
+      while (last > first && last[-1] == ' ')
+      {
+        --last;
+      }
+      auto [end, error] = std::from_chars(first, last, value, base);
+      return error == std::errc() && end == last && first < last;
+    }
+
+    // Returns false if the line is malformed; blank lines are skipped
+    static bool parseLine(const char *first, const char *last,
+                          ObjectManager::Batch &out)
+    {
+      if (last > first && last[-1] == '\r')
+      {
+        --last;
+      }
+      const char *fields[9];
+      size_t count = 0;
+      fields[count++] = first;
+      for (const char *at = first; at < last && count < 9; ++at)
+      {
+        if (*at == ',')
+        {
+          fields[count++] = at + 1;
+        }
+      }
+      if (count == 1 &&
+          std::all_of(first, last, [](char c) { return c == ' '; }))
+      {
+        return true;
+      }
+      if (count != 5 && count != 7 && count != 8)
+      {
+        return false;
+      }
+      auto fieldEnd = [&](size_t i)
+      { return i + 1 < count ? fields[i + 1] - 1 : last; };
+
+      int values[8];
+      for (size_t i = 0; i < 4; ++i)
+      {
+        if (!parseInt(fields[i], fieldEnd(i), values[i]))
+        {
+          return false;
+        }
+      }
+      SDL_Color color{0, 0, 0, 255};
+      if (count == 5)
+      {
+        const char *hex = fields[4];
+        const char *end = fieldEnd(4);
+        while (hex < end && *hex == ' ')
+        {
+          ++hex;
+        }
+        if (hex < end && *hex == '#')
+        {
+          ++hex;
+        }
+        else if (end - hex > 2 && hex[0] == '0' &&
+                 (hex[1] == 'x' || hex[1] == 'X'))
+        {
+          hex += 2;
+        }
+        Uint32 rgba = 0;
+        auto [parsed, error] = std::from_chars(hex, end, rgba, 16);
+        while (parsed < end && *parsed == ' ')
+        {
+          ++parsed;
+        }
+        if (error != std::errc() || parsed != end || hex == end)
+        {
+          return false;
+        }
+        color = SDL_Color{Uint8(rgba >> 24), Uint8(rgba >> 16),
+                          Uint8(rgba >> 8), Uint8(rgba)};
+      }
+      else
+      {
+        for (size_t i = 4; i < count; ++i)
+        {
+          if (!parseInt(fields[i], fieldEnd(i), values[i]))
+          {
+            return false;
+          }
+          values[i] = std::clamp(values[i], 0, 255);
+        }
+        color = SDL_Color{Uint8(values[4]), Uint8(values[5]), Uint8(values[6]),
+                          Uint8(count == 8 ? values[7] : 255)};
+      }
+
+      int w = std::clamp(values[2], 1, WORLD_WIDTH);
+      int h = std::clamp(values[3], 1, WORLD_HEIGHT);
+      out.xs.push_back(std::clamp(values[0], 0, WORLD_WIDTH - w));
+      out.ys.push_back(std::clamp(values[1], 0, WORLD_HEIGHT - h));
+      out.ws.push_back(w);
+      out.hs.push_back(h);
+      out.colors.push_back(color);
+      return true;
+    }
+
+    static void parseRange(const std::string &path, Range &range)
+    {
+      std::unique_ptr<FILE, decltype(&std::fclose)> in(
+          std::fopen(path.c_str(), "rb"), &std::fclose);
+      // Starting a byte early skips the line running into the range, or
+      // just the newline ending right before it
+      Uint64 lineStart = range.begin == 0 ? 0 : range.begin - 1;
+      if (!in || !seekFile(in.get(), lineStart))
+      {
+        range.error = "Cannot read " + path;
+        return;
+      }
+      bool skip = range.begin > 0;
+      bool header = range.begin == 0; // the first line may be a header
+      char *buffer = range.buffer.data();
+      size_t filled = 0;
+      while (true)
+      {
+        size_t read =
+            std::fread(buffer + filled, 1, BUFFER_SIZE - filled, in.get());
+        filled += read;
+        bool atEnd = read == 0;
+        size_t at = 0;
+        while (at < filled)
+        {
+          const char *newline = static_cast<const char *>(
+              std::memchr(buffer + at, '\n', filled - at));
+          if (!newline && !atEnd)
+          {
+            break;
+          }
+          size_t lineEnd =
+              newline ? static_cast<size_t>(newline - buffer) : filled;
+          if (!skip)
+          {
+            if (lineStart >= range.end)
+            {
+              return;
+            }
+            if (!parseLine(buffer + at, buffer + lineEnd, range.batch) &&
+                !header)
+            {
+              range.error = path + ": malformed line at byte " +
+                            std::to_string(lineStart);
+              return;
+            }
+            header = false;
+          }
+          skip = false;
+          lineStart += lineEnd - at + 1;
+          at = lineEnd + 1;
+        }
+        if (atEnd)
+        {
+          return;
+        }
+        std::memmove(buffer, buffer + at, filled - at);
+        filled -= at;
+        if (filled == BUFFER_SIZE)
+        {
+          range.error = path + ": line longer than " +
+                        std::to_string(BUFFER_SIZE) + " bytes at byte " +
+                        std::to_string(lineStart);
+          return;
+        }
+      }
+    }
+
+  public:
+    // Adds the file's rects to objects and returns how many there were.
+    // Throws on unreadable files and malformed lines, keeping the objects
+    // read before the malformed line.
+    static size_t read(const std::string &path, ThreadPool &pool,
+                       ObjectManager &objects)
+    {
+      std::error_code error;
+      Uint64 size = std::filesystem::file_size(path, error);
+      if (error)
+      {
+        throw std::runtime_error("Cannot read " + path + ": " +
+                                 error.message());
+      }
+      size_t rangeCount = static_cast<size_t>(
+          std::max<Uint64>(1, (size + RANGE_SIZE - 1) / RANGE_SIZE));
+      std::vector<Range> wave(std::min(rangeCount, pool.size() + 1));
+      for (Range &range : wave)
+      {
+        range.buffer.resize(BUFFER_SIZE);
+      }
+
+      size_t first = objects.size();
+      std::string failure;
+      for (size_t next = 0; next < rangeCount && failure.empty();)
+      {
+        size_t lanes = std::min(wave.size(), rangeCount - next);
+        for (size_t i = 0; i < lanes; ++i)
+        {
+          Range &range = wave[i];
+          range.begin = size * (next + i) / rangeCount;
+          range.end = size * (next + i + 1) / rangeCount;
+          range.batch.clear();
+          range.error.clear();
+        }
+        pool.parallelFor(lanes, [&](size_t i) { parseRange(path, wave[i]); });
+        for (size_t i = 0; i < lanes && failure.empty(); ++i)
+        {
+          objects.appendBatch(wave[i].batch);
+          failure = wave[i].error;
+        }
+        next += lanes;
+      }
+      objects.indexFrom(first);
+      if (!failure.empty())
+      {
+        throw std::runtime_error(failure);
+      }
+      return objects.size() - first;
+    }
+  };
+
+  // Synthesizes concurrent finger strokes and feeds them through the
+  // regular event queue, so the drag path can be benchmarked with many
+  // pointers. Each stroke starts on a random visible object and circles
+  // for a while before lifting.
+  class PointerReplay
+  {
+  private:
+    static constexpr SDL_TouchID REPLAY_TOUCH_ID = 0x5245504c;
+    static constexpr int STROKE_FRAMES = 120;
+
+    struct Pointer
+    {
+      float startX = 0;
+      float startY = 0;
+      int age = 0;
+      bool down = false;
+    };
+
+    std::vector<Pointer> pointers;
+    std::vector<size_t> candidates;
+    std::mt19937 rng;
+
+    static void push(Uint32 type, SDL_FingerID finger, float x, float y)
+    {
+      SDL_Event event{};
+      event.tfinger.type = type;
+      event.tfinger.timestamp = SDL_GetTicks();
+      event.tfinger.touchId = REPLAY_TOUCH_ID;
+      event.tfinger.fingerId = finger;
+      event.tfinger.x = std::clamp(x, 0.0f, 1.0f);
+      event.tfinger.y = std::clamp(y, 0.0f, 1.0f);
+      event.tfinger.pressure = 1.0f;
+      SDL_PushEvent(&event);
+    }
+
+  public:
+    explicit PointerReplay(size_t count) : pointers(count), rng(12345) {}
+
+    void step(const ObjectManager &objects, const Camera &camera)
+    {
+      objects.query(camera.viewport(), candidates);
+      for (size_t i = 0; i < pointers.size(); ++i)
+      {
+        Pointer &p = pointers[i];
+        SDL_FingerID finger = static_cast<SDL_FingerID>(i);
+        if (!p.down)
+        {
+          SDL_Rect target{0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+          if (!candidates.empty())
+          {
+            std::uniform_int_distribution<size_t> pick(0,
+                                                       candidates.size() - 1);
+            target = camera.toScreen(objects.getRect(candidates[pick(rng)]));
+          }
+          p.startX = (target.x + target.w / 2.0f) / WINDOW_WIDTH;
+          p.startY = (target.y + target.h / 2.0f) / WINDOW_HEIGHT;
+          p.age = 0;
+          p.down = true;
+          push(SDL_FINGERDOWN, finger, p.startX, p.startY);
+          continue;
+        }
+
+        float angle = 0.1f * ++p.age + static_cast<float>(i);
+        float x = p.startX + 0.05f * (std::cos(angle) - std::cos(i));
+        float y = p.startY + 0.05f * (std::sin(angle) - std::sin(i));
+        if (p.age >= STROKE_FRAMES)
+        {
+          p.down = false;
+          push(SDL_FINGERUP, finger, x, y);
+        }
+        else
+        {
+          push(SDL_FINGERMOTION, finger, x, y);
+        }
+      }
+    }
+  };
+
+public:
+  struct Options
+  {
+    size_t populate = 0;
+    size_t replayPointers = 0;
+    int frames = 0; // 0 runs until quit
+    unsigned seed = std::random_device{}();
+    std::string backend = "sdl";
+    int threads = -1; // worker threads, -1 picks one less than the CPUs
+    std::string commands; // render this command dump instead of the scene
+    std::string images; // directory of BMPs to add as image objects
+    std::string scene = "scene.mds"; // loaded if present, Ctrl+S saves
+    std::string csv; // rects to import
+    std::string exportPath = "scene.svg"; // E writes it, .svg or CSV
+    size_t imageBudgetMb = 128;
+    bool sprites = false;
+    bool dynamicResolution = false;
+    double targetFps = 60;
+    bool atlas = false; // pack sprites into atlas pages
+    size_t spriteBudgetMb = 64;
+    bool journal = false; // log edits next to the scene file
+    Uint32 journalMs = 100;
+    size_t historyMb = 64;
+    std::string checkpoint; // app state written on exit, resumed on start
+    std::string share; // shared memory name to publish the scene under
+
+    static Options parse(int argc, char *argv[])
+    {
+      Options options;
+      for (int i = 1; i < argc; ++i)
+      {
+        std::string arg = argv[i];
+        if (arg == "--dynamic-res")
+        {
+          options.dynamicResolution = true;
+          continue;
+        }
+        if (arg == "--journal")
+        {
+          options.journal = true;
+          continue;
+        }
+        if (arg == "--sprites" || arg == "--atlas")
+        {
+          options.sprites = true;
+          options.atlas = options.atlas || arg == "--atlas";
+          continue;
+        }
+        if (i + 1 >= argc)
+        {
+          throw std::runtime_error("Missing value for " + arg);
+        }
+        if (arg == "--populate")
+        {
+          options.populate = std::stoul(argv[++i]);
+        }
+        else if (arg == "--replay-pointers")
+        {
+          options.replayPointers = std::stoul(argv[++i]);
+        }
+        else if (arg == "--frames")
+        {
+          options.frames = std::stoi(argv[++i]);
+        }
+        else if (arg == "--seed")
+        {
+          options.seed = static_cast<unsigned>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--backend")
+        {
+          options.backend = argv[++i];
+        }
+        else if (arg == "--threads")
+        {
+          options.threads = std::stoi(argv[++i]);
+        }
+        else if (arg == "--commands")
+        {
+          options.commands = argv[++i];
+        }
+        else if (arg == "--images")
+        {
+          options.images = argv[++i];
+        }
+        else if (arg == "--target-fps")
+        {
+          options.targetFps = std::max(1.0, std::stod(argv[++i]));
+        }
+        else if (arg == "--scene")
+        {
+          options.scene = argv[++i];
+        }
+        else if (arg == "--import")
+        {
+          options.csv = argv[++i];
+        }
+        else if (arg == "--export")
+        {
+          options.exportPath = argv[++i];
+        }
+        else if (arg == "--image-budget")
+        {
+          options.imageBudgetMb = std::stoul(argv[++i]);
+        }
+        else if (arg == "--sprite-budget")
+        {
+          options.spriteBudgetMb = std::stoul(argv[++i]);
+        }
+        else if (arg == "--history-mb")
+        {
+          options.historyMb = std::stoul(argv[++i]);
+        }
+        else if (arg == "--checkpoint")
+        {
+          options.checkpoint = argv[++i];
+        }
+        else if (arg == "--share")
+        {
+          options.share = argv[++i];
+        }
+        else if (arg == "--journal-ms")
+        {
+          options.journalMs = static_cast<Uint32>(std::stoul(argv[++i]));
+        }
+        else
+        {
+          throw std::runtime_error("Unknown option: " + arg);
+        }
+      }
+      return options;
+    }
+  };
+
+private:
+  Options options;
+  ThreadPool pool;
+  ImageLoader imageLoader;
+  std::unique_ptr<RenderBackend> backend;
+  SdlBackend *sdlBackend = nullptr; // set when backend is the SDL one
+  std::unique_ptr<SceneJournal> journal; // outlives the saver's callbacks
+  ObjectManager objectManager;
+  SceneSaver sceneSaver;
+  Camera camera;
+  std::unique_ptr<PointerReplay> replay;
+#if !defined(_WIN32)
+  std::unique_ptr<SharedScene> sharedScene;
+#endif
+  bool running;
+
+  // The journal is compacted into a fresh scene file past this many bytes
+  static constexpr size_t JOURNAL_COMPACT_BYTES = 16 << 20;
+
+  // Right or middle button drags pan the camera
+  bool panning = false;
+
+  // Tiles whose objects project smaller than this are drawn as aggregates
+  static constexpr double LOD_MIN_PIXELS = 4.0;
+  bool lodEnabled = true;
+
+  // Objects in view and their window rects, reused across frames
+  std::vector<size_t> visible;
+  std::vector<SDL_Rect> screenRects;
+
+  // Changed areas handed to the backend. Anything that changes the whole
+  // view (camera moves, mode toggles) sets redrawAll instead.
+  std::vector<SDL_Rect> worldDamage;
+  std::vector<SDL_Rect> screenDamage;
+  Camera lastCamera;
+  bool redrawAll = true;
+
+  // The frame being drawn, and the overlay rects of this and the last one
+  CommandBuffer commandBuffer;
+  bool batchingEnabled = true;
+  std::vector<SDL_Rect> overlayRects;
+  std::vector<SDL_Rect> lastOverlayRects;
+
+  // Coarse coverage bitmap for occlusion culling, one flag per
+  // COVER_CELL x COVER_CELL block of window pixels
+  static constexpr int COVER_CELL = 8;
+  static constexpr int COVER_COLUMNS = WINDOW_WIDTH / COVER_CELL;
+  static constexpr int COVER_ROWS = WINDOW_HEIGHT / COVER_CELL;
+  std::vector<Uint8> coverage;
+  bool occlusionEnabled = true;
+
+  // Per-frame figures shown in the window title when the overlay is on.
+  // Overdraw is shaded object pixels per window pixel.
+  struct FrameStats
+  {
+    size_t drawn = 0;
+    size_t occluded = 0;
+    double overdrawBefore = 0;
+    double overdrawAfter = 0;
+    double renderMs = 0;
+    size_t presentedPixels = 0;
+    size_t commands = 0;
+    size_t commandsCulled = 0;
+    size_t commandsMerged = 0;
+    size_t stateChangesRemoved = 0;
+  };
+  FrameStats stats;
+  double totalRenderMs = 0;
+  bool showStats = false;
+  Uint32 lastStatsUpdate = 0;
+
+  // With dynamic resolution the scene is drawn at resolutionScale of the
+  // window size, steered by the smoothed render time towards the frame
+  // budget of targetFps
+  static constexpr double MIN_RESOLUTION_SCALE = 0.25;
+  static constexpr double RESOLUTION_STEP = 1.0 / 16;
+  double resolutionScale = 1.0;
+  double smoothedRenderMs = 0;
+  int framesSinceRescale = 0;
+
+  // Time spent handling input, reported when replaying pointers
+  Uint64 eventTicks = 0;
+  Uint64 maxEventTicks = 0;
+  int frameCount = 0;
+
+public:
+  explicit SDLApp(const Options &opts)
+      : options(opts),
+        pool(opts.threads >= 0
+                 ? static_cast<size_t>(opts.threads)
+                 : static_cast<size_t>(std::max(SDL_GetCPUCount() - 1, 0))),
+        imageLoader(pool.size(), opts.imageBudgetMb << 20),
+        objectManager(opts.seed), running(true)
+  {
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+      throw std::runtime_error(std::string("SDL initialization failed: ") +
+                               SDL_GetError());
+    }
+
+    window.reset(SDL_CreateWindow(WINDOW_TITLE,
+                                  SDL_WINDOWPOS_UNDEFINED,
+                                  SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH,
+                                  WINDOW_HEIGHT, SDL_WINDOW_SHOWN));
+
+    if (!window)
+    {
+      throw std::runtime_error(std::string("Window creation failed: ") +
+                               SDL_GetError());
+    }
+
+    if (options.backend != "sdl" && options.backend != "software" &&
+        options.backend != "surface")
+    {
+      throw std::runtime_error("Unknown backend: " + options.backend);
+    }
+
+    // The window surface cannot be used together with a renderer
+    if (options.backend == "surface")
+    {
+      backend = std::make_unique<SoftwareBackend>(window.get(), pool);
+    }
+    else
+    {
+      renderer.reset(
+          SDL_CreateRenderer(window.get(), -1, SDL_RENDERER_ACCELERATED));
+
+      if (!renderer)
+      {
+        throw std::runtime_error(std::string("Renderer creation failed: ") +
+                                 SDL_GetError());
+      }
+    }
+
+    if (options.backend == "sdl")
+    {
+      auto sdl = std::make_unique<SdlBackend>(renderer.get());
+      sdlBackend = sdl.get();
+      sdl->setImages(&imageLoader);
+      if (options.atlas)
+      {
+        sdl->enableAtlas(options.spriteBudgetMb << 20);
+      }
+      else if (options.sprites)
+      {
+        sdl->enableSprites(options.spriteBudgetMb << 20);
+      }
+      backend = std::move(sdl);
+    }
+    else if (options.backend == "software")
+    {
+      backend = std::make_unique<SoftwareBackend>(renderer.get(), pool,
+                                                  WINDOW_WIDTH, WINDOW_HEIGHT);
+    }
+
+    if (!options.commands.empty())
+    {
+      commandBuffer.load(options.commands);
+    }
+    objectManager.setHistoryBudget(options.historyMb << 20);
+    if (!resumeCheckpoint() && std::filesystem::exists(options.scene))
+    {
+      loadScene();
+    }
+    if (options.journal)
+    {
+      openJournal();
+    }
+    objectManager.addRandomObjects(options.populate,
+                                   SDL_Rect{0, 0, WORLD_WIDTH, WORLD_HEIGHT});
+    if (!options.csv.empty())
+    {
+      importCsv(options.csv);
+    }
+    if (journal)
+    {
+      // Bulk additions are not logged object by object; a snapshot holds
+      // them
+      objectManager.setJournal(journal.get());
+      if (options.populate > 0 || !options.csv.empty())
+      {
+        saveScene();
+      }
+    }
+    if (!options.images.empty())
+    {
+      addImageDirectory(options.images);
+    }
+    if (options.replayPointers > 0)
+    {
+      replay = std::make_unique<PointerReplay>(options.replayPointers);
+    }
+    if (!options.share.empty())
+    {
+#if defined(_WIN32)
+      throw std::runtime_error("--share needs POSIX shared memory");
+#else
+      sharedScene = std::make_unique<SharedScene>(options.share);
+#endif
+    }
+  }
+
+  ~SDLApp()
+  {
+    sceneSaver.wait();
+    reportSaves();
+    if (options.frames > 0 && frameCount > 0)
+    {
+      std::cout << "Rendered " << frameCount << " frames with "
+                << backend->name() << ": " << totalRenderMs / frameCount
+                << " ms/frame avg" << std::endl;
+    }
+    if (replay && frameCount > 0)
+    {
+      double ms = 1000.0 / SDL_GetPerformanceFrequency();
+      std::cout << "Replayed " << options.replayPointers << " pointers over "
+                << frameCount << " frames: input "
+                << eventTicks * ms / frameCount << " ms/frame avg, "
+                << maxEventTicks * ms << " ms max, "
+                << objectManager.stolenDragCount() << " contended grabs"
+                << std::endl;
+    }
+    // Members holding SDL objects would only be destroyed after this body,
+    // once SDL has shut down, so they go first
+    sdlBackend = nullptr;
+    backend.reset(); // with its sprite cache or atlas
+    imageLoader.releaseTextures();
+    renderer.reset();
+    window.reset();
+    SDL_Quit();
+  }
+
+  void handleEvents()
+  {
+    if (replay)
+    {
+      replay->step(objectManager, camera);
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
+    {
+      switch (event.type)
+      {
+      case SDL_QUIT:
+        running = false;
+        break;
+      case SDL_MOUSEBUTTONDOWN:
+        handleMouseDown(event.button);
+        break;
+      case SDL_MOUSEBUTTONUP:
+        handleMouseUp(event.button);
+        break;
+      case SDL_MOUSEMOTION:
+        handleMouseMotion(event.motion);
+        break;
+      case SDL_MOUSEWHEEL:
+        handleMouseWheel(event.wheel);
+        break;
+      case SDL_FINGERDOWN:
+      case SDL_FINGERUP:
+      case SDL_FINGERMOTION:
+        handleFinger(event.tfinger);
+        break;
+      case SDL_KEYDOWN:
+        handleKeyDown(event.key);
+        break;
+      case SDL_DROPFILE:
+        handleDropFile(event.drop.file);
+        SDL_free(event.drop.file);
+        break;
+      }
+    }
+
+    Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+    eventTicks += elapsed;
+    maxEventTicks = std::max(maxEventTicks, elapsed);
+  }
+
+  static bool hasExtension(const std::string &path, const char *extension)
+  {
+    size_t length = SDL_strlen(extension);
+    return path.size() >= length &&
+           std::equal(path.end() - length, path.end(), extension,
+                      [](char a, char b)
+                      { return std::tolower(Uint8(a)) == std::tolower(Uint8(b)); });
+  }
+
+  // Lays the directory's BMPs out in a grid from the top left of the view.
+  // Only the paths are read here; decoding happens on the loader's workers.
+  void addImageDirectory(const std::string &directory)
+  {
+    std::vector<std::string> paths;
+    std::error_code error;
+    for (const auto &entry :
+         std::filesystem::directory_iterator(directory, error))
+    {
+      if (entry.is_regular_file() && hasExtension(entry.path().string(), ".bmp"))
+      {
+        paths.push_back(entry.path().string());
+      }
+    }
+    if (error)
+    {
+      throw std::runtime_error("Cannot read " + directory + ": " +
+                               error.message());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    const int spacing = ImageLoader::OBJECT_SIZE + 10;
+    int columns = std::max(1, static_cast<int>(std::ceil(
+                                  std::sqrt(static_cast<double>(paths.size())))));
+    SDL_Point origin = camera.toWorld(10, 10);
+    objectManager.beginGroup();
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      int column = static_cast<int>(i % columns);
+      int row = static_cast<int>(i / columns);
+      objectManager.addObject(origin.x + column * spacing,
+                              origin.y + row * spacing,
+                              imageLoader.load(paths[i]));
+    }
+    objectManager.endGroup();
+  }
+
+  // A dropped BMP becomes an image object under the mouse; a dropped CSV
+  // is imported
+  void handleDropFile(const char *file)
+  {
+    std::string path = file;
+    if (hasExtension(path, ".csv"))
+    {
+      try
+      {
+        importCsv(path);
+        if (journal)
+        {
+          saveScene();
+        }
+      }
+      catch (const std::exception &e)
+      {
+        std::cerr << "Error: " << e.what() << std::endl;
+      }
+      return;
+    }
+    if (!hasExtension(path, ".bmp"))
+    {
+      return;
+    }
+    int x = 0;
+    int y = 0;
+    SDL_GetMouseState(&x, &y);
+    SDL_Point world = camera.toWorld(x, y);
+    objectManager.addObject(world.x - ImageLoader::OBJECT_SIZE / 2,
+                            world.y - ImageLoader::OBJECT_SIZE / 2,
+                            imageLoader.load(path));
+  }
+
+  void handleMouseDown(const SDL_MouseButtonEvent &event)
+  {
+    // Touch input is handled through the finger events
+    if (event.which == SDL_TOUCH_MOUSEID)
+    {
+      return;
+    }
+    if (event.button == SDL_BUTTON_LEFT)
+    {
+      SDL_Point world = camera.toWorld(event.x, event.y);
+      objectManager.pointerDown(MOUSE_POINTER, world.x, world.y, true);
+    }
+    else
+    {
+      panning = true;
+    }
+  }
+
+  void handleMouseUp(const SDL_MouseButtonEvent &event)
+  {
+    if (event.which == SDL_TOUCH_MOUSEID)
+    {
+      return;
+    }
+    if (event.button == SDL_BUTTON_LEFT)
+    {
+      objectManager.endDrag(MOUSE_POINTER);
+    }
+    else
+    {
+      panning = false;
+    }
+  }
+
+  void handleMouseMotion(const SDL_MouseMotionEvent &event)
+  {
+    if (event.which == SDL_TOUCH_MOUSEID)
+    {
+      return;
+    }
+    if (panning)
+    {
+      camera.panBy(event.xrel, event.yrel);
+    }
+    SDL_Point world = camera.toWorld(event.x, event.y);
+    objectManager.updateDrag(MOUSE_POINTER, world.x, world.y);
+  }
+
+  void handleMouseWheel(const SDL_MouseWheelEvent &event)
+  {
+    int mouseX, mouseY;
+    SDL_GetMouseState(&mouseX, &mouseY);
+    camera.zoomAt(mouseX, mouseY, std::pow(1.25, event.y));
+  }
+
+  // Finger coordinates are normalized to the window
+  void handleFinger(const SDL_TouchFingerEvent &event)
+  {
+    PointerId pointer{event.touchId, event.fingerId};
+    SDL_Point world =
+        camera.toWorld(static_cast<int>(event.x * WINDOW_WIDTH),
+                       static_cast<int>(event.y * WINDOW_HEIGHT));
+    switch (event.type)
+    {
+    case SDL_FINGERDOWN:
+      objectManager.pointerDown(pointer, world.x, world.y, false);
+      break;
+    case SDL_FINGERMOTION:
+      objectManager.updateDrag(pointer, world.x, world.y);
+      break;
+    case SDL_FINGERUP:
+      objectManager.endDrag(pointer);
+      break;
+    }
+  }
+
+  void handleKeyDown(const SDL_KeyboardEvent &event)
+  {
+    switch (event.keysym.sym)
+    {
+    case SDLK_ESCAPE:
+      running = false;
+      break;
+    case SDLK_LEFT:
+      camera.panBy(100, 0);
+      break;
+    case SDLK_RIGHT:
+      camera.panBy(-100, 0);
+      break;
+    case SDLK_UP:
+      camera.panBy(0, 100);
+      break;
+    case SDLK_DOWN:
+      camera.panBy(0, -100);
+      break;
+    case SDLK_PLUS:
+    case SDLK_EQUALS:
+    case SDLK_KP_PLUS:
+      camera.zoomAt(WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 1.25);
+      break;
+    case SDLK_MINUS:
+    case SDLK_KP_MINUS:
+      camera.zoomAt(WINDOW_WIDTH / 2, WINDOW_HEIGHT / 2, 0.8);
+      break;
+    case SDLK_HOME:
+      camera = Camera{};
+      break;
+    case SDLK_a:
+      if (event.keysym.mod & KMOD_CTRL)
+      {
+        objectManager.selectAll();
+      }
+      break;
+    case SDLK_l:
+      lodEnabled = !lodEnabled;
+      redrawAll = true;
+      break;
+    case SDLK_o:
+      occlusionEnabled = !occlusionEnabled;
+      redrawAll = true;
+      break;
+    case SDLK_F1:
+      showStats = !showStats;
+      if (!showStats)
+      {
+        SDL_SetWindowTitle(window.get(), WINDOW_TITLE);
+      }
+      break;
+    case SDLK_F2:
+      dumpCommands();
+      break;
+    case SDLK_b:
+      batchingEnabled = !batchingEnabled;
+      break;
+    case SDLK_r:
+      options.dynamicResolution = !options.dynamicResolution;
+      if (!options.dynamicResolution)
+      {
+        setResolutionScale(1.0);
+      }
+      break;
+    case SDLK_s:
+      if (event.keysym.mod & KMOD_CTRL)
+      {
+        saveScene();
+        break;
+      }
+      options.sprites = !options.sprites;
+      if (options.sprites && sdlBackend && !sdlBackend->spriteCounters())
+      {
+        sdlBackend->enableSprites(options.spriteBudgetMb << 20);
+      }
+      break;
+    case SDLK_p:
+      objectManager.addRandomObjects(10000, camera.viewport());
+      break;
+    case SDLK_c:
+      objectManager.recolorSelected();
+      break;
+    case SDLK_z:
+    case SDLK_y:
+      if (event.keysym.mod & KMOD_CTRL)
+      {
+        bool redo = event.keysym.sym == SDLK_y ||
+                    (event.keysym.mod & KMOD_SHIFT) != 0;
+        if (redo ? objectManager.redo() : objectManager.undo())
+        {
+          redrawAll = true;
+        }
+      }
+      break;
+    case SDLK_e:
+      sceneSaver.exportTo(objectManager.snapshot(), options.exportPath,
+                          imageLoader.paths());
+      break;
+    case SDLK_DELETE:
+      objectManager.deleteSelected();
+      break;
+    }
+  }
+
+  // Tells the backend which window areas changed since the last frame
+  void updateDamage()
+  {
+    bool all = objectManager.takeDamage(worldDamage);
+    if (all || redrawAll || !(camera == lastCamera))
+    {
+      backend->setDamage(nullptr);
+      lastOverlayRects = overlayRects;
+      lastCamera = camera;
+      redrawAll = false;
+      return;
+    }
+    screenDamage.clear();
+    for (const SDL_Rect &rect : worldDamage)
+    {
+      // One pixel of slack for rounding in toScreen
+      SDL_Rect screen = camera.toScreen(rect);
+      screenDamage.push_back(
+          SDL_Rect{screen.x - 1, screen.y - 1, screen.w + 2, screen.h + 2});
+    }
+    // Overlays are redrawn where they were and where they are now
+    screenDamage.insert(screenDamage.end(), lastOverlayRects.begin(),
+                        lastOverlayRects.end());
+    screenDamage.insert(screenDamage.end(), overlayRects.begin(),
+                        overlayRects.end());
+    lastOverlayRects = overlayRects;
+    if (resolutionScale != 1.0)
+    {
+      for (SDL_Rect &rect : screenDamage)
+      {
+        rect = CommandBuffer::scaleRect(rect, resolutionScale, true);
+      }
+    }
+    backend->setDamage(&screenDamage);
+  }
+
+  void render()
+  {
+    if (options.commands.empty())
+    {
+      // Newly decoded images replace placeholders wherever they are
+      if (imageLoader.poll() > 0)
+      {
+        redrawAll = true;
+      }
+      recordScene();
+      stats.commandsCulled = commandBuffer.cull(WINDOW_WIDTH, WINDOW_HEIGHT);
+      stats.stateChangesRemoved =
+          batchingEnabled ? commandBuffer.batchByColor() : 0;
+      stats.commandsMerged = commandBuffer.mergeSpans();
+      updateDamage();
+    }
+    else
+    {
+      // Replaying a dumped frame: redraw it whole every time
+      backend->setDamage(nullptr);
+    }
+    stats.commands = commandBuffer.commands.size();
+    commandBuffer.submit(*backend, resolutionScale);
+    backend->present();
+    stats.presentedPixels = backend->presentedPixels();
+  }
+
+  // Fills the command buffer with the current frame
+  void recordScene()
+  {
+    using Type = CommandBuffer::Type;
+    commandBuffer.reset(SDL_Color{240, 240, 240, 255});
+
+    // Tiles of sub-pixel objects become one rect in their area-weighted
+    // color, faded towards the background by how much of the tile is
+    // covered. The rest are drawn object by object, on top.
+    SDL_Rect view = camera.viewport();
+    if (lodEnabled)
+    {
+      visible.clear();
+      objectManager.getLod().forEachTile(
+          view, [&](const SDL_Rect &area, const LodTiles::Tile &tile) {
+            double size = std::sqrt(static_cast<double>(tile.area) /
+                                    tile.count) *
+                          camera.zoom;
+            if (size >= LOD_MIN_PIXELS)
+            {
+              objectManager.collectCentered(area, view, visible);
+              return;
+            }
+            if (!SDL_HasIntersection(&area, &view))
+            {
+              // Only visited for objects reaching into the view; the
+              // aggregate itself is out of it
+              return;
+            }
+            double coverage = std::min(
+                1.0, static_cast<double>(tile.area) /
+                         (static_cast<double>(area.w) * area.h));
+            auto blend = [&](Uint64 sum) {
+              return static_cast<Uint8>(240 * (1 - coverage) +
+                                        coverage * sum / tile.area);
+            };
+            commandBuffer.add(Type::Fill, camera.toScreen(area),
+                              SDL_Color{blend(tile.r), blend(tile.g),
+                                        blend(tile.b), 255});
+          });
+      objectManager.sortByZ(visible);
+    }
+    else
+    {
+      objectManager.query(view, visible);
+    }
+
+    screenRects.resize(visible.size());
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+      screenRects[i] = camera.toScreen(objectManager.getRect(visible[i]));
+    }
+    stats.overdrawBefore = overdraw();
+    stats.occluded = occlusionEnabled ? cullOccluded() : 0;
+    stats.overdrawAfter = overdraw();
+    stats.drawn = visible.size();
+
+    // Objects in view, bottom to top, each with its border; selected
+    // objects get a highlighted border
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+      size_t slot = visible[i];
+      SDL_Color border = objectManager.isSelected(slot)
+                             ? SDL_Color{0, 120, 215, 255}
+                             : SDL_Color{0, 0, 0, 255};
+      Uint32 image = objectManager.getImage(slot);
+      if (image != 0 && imageLoader.isReady(image))
+      {
+        commandBuffer.addImage(screenRects[i], image,
+                               imageLoader.get(image).average);
+        commandBuffer.add(Type::Outline, screenRects[i], border);
+        continue;
+      }
+      if (options.sprites)
+      {
+        commandBuffer.addSprite(screenRects[i], objectManager.getColor(slot),
+                                border);
+        continue;
+      }
+      commandBuffer.add(Type::Fill, screenRects[i],
+                        objectManager.getColor(slot));
+      commandBuffer.add(Type::Outline, screenRects[i], border);
+    }
+
+    // Markers for touch and replayed pointers that are dragging
+    overlayRects.clear();
+    objectManager.forEachDragPointer([&](PointerId pointer, int x, int y) {
+      if (pointer != MOUSE_POINTER)
+      {
+        SDL_Rect point = camera.toScreen(SDL_Rect{x, y, 1, 1});
+        overlayRects.push_back(SDL_Rect{point.x - 3, point.y - 3, 7, 7});
+      }
+    });
+    for (const SDL_Rect &rect : overlayRects)
+    {
+      commandBuffer.add(Type::Overlay, rect, SDL_Color{220, 40, 40, 255});
+    }
+  }
+
+  void loadScene()
+  {
+    objectManager.load(options.scene, [this](const std::string &path)
+                       { return imageLoader.load(path); });
+    redrawAll = true;
+  }
+
+  // Resumes from --checkpoint unless the scene file was saved after it.
+  // A journal left by a run that did not exit cleanly is still replayed
+  // on top: its edits are idempotent.
+  bool resumeCheckpoint()
+  {
+    if (options.checkpoint.empty() ||
+        !std::filesystem::exists(options.checkpoint))
+    {
+      return false;
+    }
+    if (std::filesystem::exists(options.scene) &&
+        std::filesystem::last_write_time(options.scene) >
+            std::filesystem::last_write_time(options.checkpoint))
+    {
+      std::cout << "Ignoring " << options.checkpoint << ", " << options.scene
+                << " is newer" << std::endl;
+      return false;
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    if (!objectManager.resume(options.checkpoint,
+                              [this](const std::string &path)
+                              { return imageLoader.load(path); },
+                              camera))
+    {
+      std::cerr << "Error: " << options.checkpoint
+                << " is not a checkpoint of this build" << std::endl;
+      return false;
+    }
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                SDL_GetPerformanceFrequency();
+    std::cout << "Resumed " << objectManager.size() << " objects from "
+              << options.checkpoint << " in " << ms << " ms" << std::endl;
+    redrawAll = true;
+    return true;
+  }
+
+  // Waits for pending saves first, so the scene file is not left newer
+  // than the checkpoint. With a journal the scene is saved too, which
+  // compacts the journal, so the next start has nothing to replay and the
+  // scene file alone still holds every edit.
+  void writeCheckpoint()
+  {
+    if (journal && journal->pendingBytes() > 0)
+    {
+      saveScene();
+    }
+    sceneSaver.wait();
+    reportSaves();
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<std::string> imagePaths = imageLoader.paths();
+    objectManager.checkpoint(
+        options.checkpoint,
+        [&imagePaths](Uint32 image) { return imagePaths[image - 1]; }, camera);
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                SDL_GetPerformanceFrequency();
+    std::cout << "Wrote checkpoint " << options.checkpoint << " in " << ms
+              << " ms" << std::endl;
+  }
+
+  void importCsv(const std::string &path)
+  {
+    Uint64 start = SDL_GetPerformanceCounter();
+    size_t count = CsvImporter::read(path, pool, objectManager);
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                SDL_GetPerformanceFrequency();
+    std::cout << "Imported " << count << " objects from " << path << " in "
+              << ms << " ms" << std::endl;
+  }
+
+  // Replays the journal left by earlier runs onto the loaded scene and
+  // opens it for this run's edits
+  void openJournal()
+  {
+    size_t replayed = SceneJournal::recover(
+        options.scene,
+        [this](const SceneJournal::Record &record, const std::string &image)
+        {
+          objectManager.replay(record, image, [this](const std::string &path)
+                               { return imageLoader.load(path); });
+        });
+    if (replayed > 0)
+    {
+      std::cout << "Replayed " << replayed << " journaled edits" << std::endl;
+    }
+    journal = std::make_unique<SceneJournal>(
+        options.scene, options.journalMs,
+        [this](Uint32 image) { return imageLoader.get(image).path; });
+    redrawAll = true;
+  }
+
+  // Only takes a snapshot here; the file is written by sceneSaver. With a
+  // journal this is also its compaction: the segments written before the
+  // snapshot are deleted once it is saved.
+  void saveScene()
+  {
+    std::function<void()> onSaved;
+    if (journal)
+    {
+      Uint64 sealed = journal->rotate();
+      onSaved = [target = journal.get(), sealed]
+      { target->compacted(sealed); };
+    }
+    sceneSaver.save(objectManager.snapshot(), options.scene,
+                    imageLoader.paths(), std::move(onSaved));
+  }
+
+  void reportSaves()
+  {
+    for (const SceneSaver::Report &report : sceneSaver.poll())
+    {
+      if (report.ok)
+      {
+        std::cout << report.message << std::endl;
+      }
+      else
+      {
+        std::cerr << "Error: " << report.message << std::endl;
+      }
+    }
+  }
+
+  void dumpCommands()
+  {
+    std::string path = "commands-" + std::to_string(frameCount) + ".txt";
+    commandBuffer.save(path);
+    std::cout << "Wrote " << commandBuffer.commands.size() << " commands to "
+              << path << std::endl;
+  }
+
+  // Drops objects whose window rect lies entirely under opaque objects
+  // drawn above them. Walks front to back, marking cells fully inside each
+  // opaque rect; an object is hidden when every cell it touches is marked.
+  // Returns the number of objects removed.
+  size_t cullOccluded()
+  {
+    coverage.assign(COVER_COLUMNS * COVER_ROWS, 0);
+    std::vector<Uint8> keep(visible.size(), 1);
+    size_t culled = 0;
+    for (size_t i = visible.size(); i-- > 0;)
+    {
+      SDL_Rect window{0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+      SDL_Rect rect;
+      if (!SDL_IntersectRect(&screenRects[i], &window, &rect))
+      {
+        continue;
+      }
+
+      // Cells touched by the rect
+      int tx0 = rect.x / COVER_CELL;
+      int ty0 = rect.y / COVER_CELL;
+      int tx1 = std::min((rect.x + rect.w - 1) / COVER_CELL, COVER_COLUMNS - 1);
+      int ty1 = std::min((rect.y + rect.h - 1) / COVER_CELL, COVER_ROWS - 1);
+      bool hidden = true;
+      for (int cy = ty0; cy <= ty1 && hidden; ++cy)
+      {
+        for (int cx = tx0; cx <= tx1 && hidden; ++cx)
+        {
+          hidden = coverage[cy * COVER_COLUMNS + cx] != 0;
+        }
+      }
+      if (hidden)
+      {
+        keep[i] = 0;
+        ++culled;
+        continue;
+      }
+
+      // Cells fully inside the rect
+      if (objectManager.getColor(visible[i]).a == 255)
+      {
+        int fx0 = (rect.x + COVER_CELL - 1) / COVER_CELL;
+        int fy0 = (rect.y + COVER_CELL - 1) / COVER_CELL;
+        int fx1 = std::min((rect.x + rect.w) / COVER_CELL, COVER_COLUMNS);
+        int fy1 = std::min((rect.y + rect.h) / COVER_CELL, COVER_ROWS);
+        for (int cy = fy0; cy < fy1; ++cy)
+        {
+          std::fill(coverage.begin() + cy * COVER_COLUMNS + fx0,
+                    coverage.begin() + cy * COVER_COLUMNS + fx1, 1);
+        }
+      }
+    }
+
+    size_t out = 0;
+    for (size_t i = 0; i < visible.size(); ++i)
+    {
+      if (keep[i])
+      {
+        visible[out] = visible[i];
+        screenRects[out] = screenRects[i];
+        ++out;
+      }
+    }
+    visible.resize(out);
+    screenRects.resize(out);
+    return culled;
+  }
+
+  double overdraw() const
+  {
+    SDL_Rect window{0, 0, WINDOW_WIDTH, WINDOW_HEIGHT};
+    double shaded = 0;
+    for (const SDL_Rect &rect : screenRects)
+    {
+      SDL_Rect clipped;
+      if (SDL_IntersectRect(&rect, &window, &clipped))
+      {
+        shaded += static_cast<double>(clipped.w) * clipped.h;
+      }
+    }
+    return shaded / (static_cast<double>(WINDOW_WIDTH) * WINDOW_HEIGHT);
+  }
+
+  void updateStatsTitle()
+  {
+    Uint32 now = SDL_GetTicks();
+    if (now - lastStatsUpdate < 500)
+    {
+      return;
+    }
+    lastStatsUpdate = now;
+    char title[256];
+    SDL_snprintf(title, sizeof(title),
+                 "%s | %.2f ms | %zu drawn, %zu occluded | overdraw %.2fx -> "
+                 "%.2fx | %zu cmds (%zu culled, %zu merged) | %zu state "
+                 "changes saved | %zu KB presented",
+                 WINDOW_TITLE, stats.renderMs, stats.drawn, stats.occluded,
+                 stats.overdrawBefore, stats.overdrawAfter, stats.commands,
+                 stats.commandsCulled, stats.commandsMerged,
+                 stats.stateChangesRemoved, stats.presentedPixels * 4 / 1024);
+    const SpriteCounters *sprites =
+        sdlBackend ? sdlBackend->spriteCounters() : nullptr;
+    if (sprites)
+    {
+      size_t length = SDL_strlen(title);
+      SDL_snprintf(title + length, sizeof(title) - length,
+                   " | sprites %zu hit, %zu miss, %zu KB, %zu repacks",
+                   sprites->hits, sprites->misses, sprites->bytes / 1024,
+                   sprites->repacks);
+    }
+    if (options.dynamicResolution)
+    {
+      size_t length = SDL_strlen(title);
+      SDL_snprintf(title + length, sizeof(title) - length, " | res %d%%",
+                   static_cast<int>(resolutionScale * 100 + 0.5));
+    }
+    SDL_SetWindowTitle(window.get(), title);
+  }
+
+  // Fill cost goes with the pixel count, i.e. the square of the scale, so
+  // the next scale is the current one times the square root of how far
+  // the frame is off budget. Steps are quantized and spaced out so the
+  // smoothed time settles before the next change.
+  void adjustResolution()
+  {
+    smoothedRenderMs = smoothedRenderMs * 0.9 + stats.renderMs * 0.1;
+    if (++framesSinceRescale < 15 || smoothedRenderMs <= 0)
+    {
+      return;
+    }
+    double budgetMs = 1000.0 / options.targetFps;
+    double ideal = resolutionScale * std::sqrt(0.8 * budgetMs / smoothedRenderMs);
+    double next = std::round(ideal / RESOLUTION_STEP) * RESOLUTION_STEP;
+    next = std::clamp(next, MIN_RESOLUTION_SCALE, 1.0);
+    setResolutionScale(next);
+  }
+
+  void setResolutionScale(double scale)
+  {
+    if (scale == resolutionScale || !backend->setResolutionScale(scale))
+    {
+      return;
+    }
+    resolutionScale = scale;
+    framesSinceRescale = 0;
+    redrawAll = true;
+  }
+
+  void run()
+  {
+    while (running)
+    {
+      handleEvents();
+#if !defined(_WIN32)
+      if (sharedScene)
+      {
+        sharedScene->publish(objectManager.snapshot());
+      }
+#endif
+      reportSaves();
+      if (journal && journal->pendingBytes() >= JOURNAL_COMPACT_BYTES)
+      {
+        saveScene();
+      }
+      Uint64 start = SDL_GetPerformanceCounter();
       render();
+      stats.renderMs = (SDL_GetPerformanceCounter() - start) * 1000.0 /
+                       SDL_GetPerformanceFrequency();
+      totalRenderMs += stats.renderMs;
+      if (options.dynamicResolution)
+      {
+        adjustResolution();
+      }
+      if (showStats)
+      {
+        updateStatsTitle();
+      }
       SDL_Delay(16); // Cap at roughly 60 FPS
+      if (++frameCount == options.frames)
+      {
+        running = false;
+      }
+    }
+    if (!options.checkpoint.empty())
+    {
+      writeCheckpoint();
     }
   }
 };
@@ -245,7 +6546,7 @@ int main(int argc, char *argv[])
 {
   try
   {
-    SDLApp app;
+    SDLApp app(SDLApp::Options::parse(argc, argv));
     app.run();
     return 0;
   }
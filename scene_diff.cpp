@@ -0,0 +1,561 @@
+// Compares and merges scene files saved by multi_drag, matching objects by
+// id. Both walk the files' id columns, which are ascending, side by side,
+// so the work is linear in the number of objects and the files are only
+// read through private mappings.
+//
+// Compile with:
+// g++ -O2 scene_diff.cpp -o scene_diff
+//
+// Run with:
+// ./scene_diff diff [--summary] OLD NEW
+// ./scene_diff merge BASE OURS THEIRS OUT
+//
+// diff prints one line per changed object:
+//   + id x,y wxh rrggbbaa   added
+//   - id                    deleted
+//   m id x,y -> x,y         moved
+//   c id rrggbbaa -> ...    recolored
+//   i id path -> path       image changed, - for none
+//   z id z -> z             restacked
+// followed by a summary line; --summary prints only the summary. The exit
+// status is 0 when the scenes match and 1 when they differ.
+//
+// merge applies the changes from BASE to THEIRS on top of OURS and writes
+// the result to OUT. Each attribute of an object (place, look, stacking)
+// comes from whichever side changed it; where both changed it differently
+// ours wins. An object one side deleted and the other changed is kept as
+// changed. Both kinds of clash are reported as conflicts, and the exit
+// status is then 1. Objects added on both sides are all kept, theirs
+// renumbered after ours and stacked above them. Tombstones are not carried
+// over.
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "scene_file.h"
+
+namespace
+{
+struct Color
+{
+  uint8_t r, g, b, a;
+
+  bool operator==(const Color &other) const
+  {
+    return r == other.r && g == other.g && b == other.b && a == other.a;
+  }
+};
+
+// One object as read from a scene
+struct Row
+{
+  uint64_t id;
+  int32_t x, y, w, h;
+  Color color;
+  uint32_t z;
+  uint8_t selected;
+  const std::string *image; // nullptr for plain rects
+};
+
+// The columns of a mapped scene file, used in place
+class SceneView
+{
+private:
+  MappedFile file;
+  const int32_t *xs, *ys, *ws, *hs;
+  const Color *colors;
+  const uint32_t *zs;
+  const uint8_t *selected;
+  const uint32_t *images;
+  const uint64_t *ids;
+  const uint8_t *deleted = nullptr; // optional
+
+  template <typename T>
+  const T *column(const SceneFileHeader &header, SceneColumn id,
+                  const std::string &path, bool required = true)
+  {
+    const SceneColumnEntry *entry = findSceneColumn(header, id);
+    if (!entry)
+    {
+      if (required)
+      {
+        throw std::runtime_error(path + " lacks scene column " +
+                                 std::to_string(static_cast<uint32_t>(id)));
+      }
+      return nullptr;
+    }
+    if (entry->elementSize != sizeof(T))
+    {
+      throw std::runtime_error(path + " is damaged");
+    }
+    return reinterpret_cast<const T *>(file.data() + entry->offset);
+  }
+
+public:
+  const SceneFileHeader &header;
+  std::vector<std::string> imagePaths; // by image index - 1
+
+  explicit SceneView(const std::string &path)
+      : file(path), header(sceneFileHeader(file, path))
+  {
+    xs = column<int32_t>(header, SceneColumn::X, path);
+    ys = column<int32_t>(header, SceneColumn::Y, path);
+    ws = column<int32_t>(header, SceneColumn::Width, path);
+    hs = column<int32_t>(header, SceneColumn::Height, path);
+    colors = column<Color>(header, SceneColumn::Color, path);
+    zs = column<uint32_t>(header, SceneColumn::Z, path);
+    selected = column<uint8_t>(header, SceneColumn::Selected, path);
+    images = column<uint32_t>(header, SceneColumn::Image, path);
+    ids = column<uint64_t>(header, SceneColumn::Id, path);
+    deleted = column<uint8_t>(header, SceneColumn::Deleted, path, false);
+
+    const char *strings =
+        reinterpret_cast<const char *>(file.data() + header.stringsOffset);
+    for (uint64_t at = 0; at < header.stringsSize;)
+    {
+      const char *end = static_cast<const char *>(
+          std::memchr(strings + at, 0, header.stringsSize - at));
+      if (!end)
+      {
+        throw std::runtime_error(path + " is damaged");
+      }
+      imagePaths.emplace_back(strings + at, end);
+      at = static_cast<uint64_t>(end - strings) + 1;
+    }
+    for (uint64_t i = 1; i < header.objectCount; ++i)
+    {
+      if (ids[i] <= ids[i - 1])
+      {
+        throw std::runtime_error(path + " has unsorted object ids");
+      }
+    }
+  }
+
+  uint64_t size() const { return header.objectCount; }
+
+  bool live(uint64_t i) const { return !deleted || !deleted[i]; }
+
+  uint64_t id(uint64_t i) const { return ids[i]; }
+
+  Row row(uint64_t i) const
+  {
+    uint32_t image = images[i];
+    return Row{ids[i],      xs[i],       ys[i], ws[i], hs[i],
+               colors[i],   zs[i],       selected[i],
+               image && image <= imagePaths.size() ? &imagePaths[image - 1]
+                                                   : nullptr};
+  }
+};
+
+// Walks the live objects of several scenes in id order. For every id
+// present in any of them, visit gets a row pointer per scene, nullptr
+// where the scene lacks the object.
+template <size_t N, typename Visit>
+void walkById(const SceneView *const (&scenes)[N], Visit &&visit)
+{
+  uint64_t at[N] = {};
+  while (true)
+  {
+    for (size_t s = 0; s < N; ++s)
+    {
+      while (at[s] < scenes[s]->size() && !scenes[s]->live(at[s]))
+      {
+        ++at[s];
+      }
+    }
+    uint64_t next = UINT64_MAX;
+    bool any = false;
+    for (size_t s = 0; s < N; ++s)
+    {
+      if (at[s] < scenes[s]->size())
+      {
+        next = std::min(next, scenes[s]->id(at[s]));
+        any = true;
+      }
+    }
+    if (!any)
+    {
+      return;
+    }
+    Row rows[N];
+    const Row *present[N];
+    for (size_t s = 0; s < N; ++s)
+    {
+      present[s] = nullptr;
+      if (at[s] < scenes[s]->size() && scenes[s]->id(at[s]) == next)
+      {
+        rows[s] = scenes[s]->row(at[s]++);
+        present[s] = &rows[s];
+      }
+    }
+    visit(present);
+  }
+}
+
+bool samePlace(const Row &a, const Row &b)
+{
+  return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
+bool sameImage(const Row &a, const Row &b)
+{
+  return a.image == b.image || (a.image && b.image && *a.image == *b.image);
+}
+
+void printColor(FILE *out, const Color &color)
+{
+  std::fprintf(out, "%02x%02x%02x%02x", color.r, color.g, color.b, color.a);
+}
+
+int diff(const std::string &oldPath, const std::string &newPath,
+         bool summaryOnly)
+{
+  SceneView before(oldPath);
+  SceneView after(newPath);
+  static char buffer[1 << 16];
+  std::setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
+  uint64_t added = 0, deleted = 0, moved = 0, recolored = 0, reimaged = 0;
+  uint64_t restacked = 0;
+  const SceneView *const scenes[2] = {&before, &after};
+  walkById(scenes, [&](const Row *const(&rows)[2]) {
+    const Row *a = rows[0];
+    const Row *b = rows[1];
+    if (!a)
+    {
+      ++added;
+      if (!summaryOnly)
+      {
+        std::printf("+ %llu %d,%d %dx%d ", (unsigned long long)b->id, b->x,
+                    b->y, b->w, b->h);
+        printColor(stdout, b->color);
+        std::printf("\n");
+      }
+      return;
+    }
+    if (!b)
+    {
+      ++deleted;
+      if (!summaryOnly)
+      {
+        std::printf("- %llu\n", (unsigned long long)a->id);
+      }
+      return;
+    }
+    if (!samePlace(*a, *b))
+    {
+      ++moved;
+      if (!summaryOnly)
+      {
+        std::printf("m %llu %d,%d -> %d,%d\n", (unsigned long long)a->id,
+                    a->x, a->y, b->x, b->y);
+      }
+    }
+    if (!(a->color == b->color))
+    {
+      ++recolored;
+      if (!summaryOnly)
+      {
+        std::printf("c %llu ", (unsigned long long)a->id);
+        printColor(stdout, a->color);
+        std::printf(" -> ");
+        printColor(stdout, b->color);
+        std::printf("\n");
+      }
+    }
+    if (!sameImage(*a, *b))
+    {
+      ++reimaged;
+      if (!summaryOnly)
+      {
+        std::printf("i %llu %s -> %s\n", (unsigned long long)a->id,
+                    a->image ? a->image->c_str() : "-",
+                    b->image ? b->image->c_str() : "-");
+      }
+    }
+    if (a->z != b->z)
+    {
+      ++restacked;
+      if (!summaryOnly)
+      {
+        std::printf("z %llu %u -> %u\n", (unsigned long long)a->id, a->z,
+                    b->z);
+      }
+    }
+  });
+  std::printf("%llu added, %llu deleted, %llu moved, %llu recolored, "
+              "%llu reimaged, %llu restacked\n",
+              (unsigned long long)added, (unsigned long long)deleted,
+              (unsigned long long)moved, (unsigned long long)recolored,
+              (unsigned long long)reimaged, (unsigned long long)restacked);
+  std::fflush(stdout);
+  return added + deleted + moved + recolored + reimaged + restacked > 0 ? 1
+                                                                        : 0;
+}
+
+// Takes whichever side changed an attribute; ours when both did
+template <typename Same>
+const Row &pick(const Row &base, const Row &ours, const Row &theirs,
+                Same &&same, uint64_t &conflicts)
+{
+  if (same(ours, base))
+  {
+    return theirs;
+  }
+  if (!same(theirs, base) && !same(ours, theirs))
+  {
+    ++conflicts;
+  }
+  return ours;
+}
+
+class MergeWriter
+{
+private:
+  const SceneView &base, &ours, &theirs;
+  uint64_t conflicts = 0;
+  uint64_t count = 0;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint32_t> stringIndex;
+
+  // Calls emit(row) for every object of the result, in id order. Objects
+  // theirs added get ids after everything ours holds, and z values above
+  // all of ours in their own stacking order, so no two objects share one.
+  template <typename Emit> void walk(Emit &&emit)
+  {
+    uint64_t baseNextId = base.header.nextId;
+    const SceneView *const scenes[3] = {&base, &ours, &theirs};
+    uint64_t clashes = 0;
+    std::vector<Row> theirsAdded;
+    auto sameLook = [](const Row &x, const Row &y)
+    { return x.color == y.color && sameImage(x, y); };
+    auto sameZ = [](const Row &x, const Row &y) { return x.z == y.z; };
+    walkById(scenes, [&](const Row *const(&rows)[3]) {
+      const Row *b = rows[0];
+      const Row *o = rows[1];
+      const Row *t = rows[2];
+      if (!b)
+      {
+        // Ids past the base were handed out on each side independently;
+        // lower ones are objects the base held as tombstones
+        if (o)
+        {
+          emit(*o);
+        }
+        if (t && t->id >= baseNextId)
+        {
+          theirsAdded.push_back(*t);
+        }
+        else if (t && !o)
+        {
+          emit(*t);
+        }
+        return;
+      }
+      if (!o || !t)
+      {
+        const Row *kept = o ? o : t;
+        if (!kept)
+        {
+          return; // deleted on both sides
+        }
+        if (!samePlace(*kept, *b) || !sameLook(*kept, *b) ||
+            !sameZ(*kept, *b))
+        {
+          ++clashes; // deleted on one side, edited on the other
+          emit(*kept);
+        }
+        return;
+      }
+      Row merged = pick(*b, *o, *t, samePlace, clashes);
+      const Row &look = pick(*b, *o, *t, sameLook, clashes);
+      merged.color = look.color;
+      merged.image = look.image;
+      merged.z = pick(*b, *o, *t, sameZ, clashes).z;
+      merged.selected = o->selected;
+      emit(merged);
+    });
+    std::vector<std::pair<uint32_t, size_t>> byZ;
+    byZ.reserve(theirsAdded.size());
+    for (size_t i = 0; i < theirsAdded.size(); ++i)
+    {
+      byZ.emplace_back(theirsAdded[i].z, i);
+    }
+    std::sort(byZ.begin(), byZ.end());
+    uint32_t nextZ = ours.header.nextZ;
+    for (const auto &entry : byZ)
+    {
+      theirsAdded[entry.second].z = nextZ++;
+    }
+    uint64_t nextId = ours.header.nextId;
+    for (Row &row : theirsAdded)
+    {
+      row.id = nextId++;
+      emit(row);
+    }
+    conflicts = clashes;
+  }
+
+public:
+  MergeWriter(const SceneView &baseScene, const SceneView &oursScene,
+              const SceneView &theirsScene)
+      : base(baseScene), ours(oursScene), theirs(theirsScene)
+  {
+  }
+
+  uint64_t conflictCount() const { return conflicts; }
+  uint64_t objectCount() const { return count; }
+
+  void write(const std::string &path)
+  {
+    // The first walk counts, collects image paths and finds the id range
+    uint64_t lastId = 0;
+    uint32_t nextZ = std::max(ours.header.nextZ, theirs.header.nextZ);
+    count = 0;
+    walk([&](const Row &row) {
+      ++count;
+      lastId = row.id;
+      nextZ = std::max(nextZ, row.z + 1);
+      if (row.image && stringIndex.count(*row.image) == 0)
+      {
+        strings.push_back(*row.image);
+        stringIndex.emplace(*row.image, static_cast<uint32_t>(strings.size()));
+      }
+    });
+
+    SceneFileHeader header{};
+    std::memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCENE_FILE_VERSION;
+    header.byteOrder = SCENE_BYTE_ORDER;
+    header.objectCount = count;
+    header.nextId = std::max({ours.header.nextId, theirs.header.nextId,
+                              lastId + 1});
+    header.nextZ = nextZ;
+
+    // Lay out zeroed columns, then fill them all in a second walk, each
+    // through a batch that is written in place once full
+    struct Pending
+    {
+      uint64_t offset;
+      std::vector<uint8_t> bytes;
+    };
+    static constexpr size_t BATCH_BYTES = 1 << 16;
+    Pending columns[9];
+    AtomicFile out(path);
+    out.write(&header, sizeof(header)); // rewritten once complete
+    auto layout = [&](SceneColumn id, uint32_t elementSize)
+    {
+      out.align(SCENE_FILE_ALIGN);
+      SceneColumnEntry &entry = header.columns[header.columnCount];
+      entry.column = static_cast<uint32_t>(id);
+      entry.elementSize = elementSize;
+      entry.offset = out.position();
+      entry.size = sceneColumnBytes(count, elementSize);
+      out.padTo(entry.offset + entry.size);
+      columns[header.columnCount++].offset = entry.offset;
+    };
+    layout(SceneColumn::X, sizeof(int32_t));
+    layout(SceneColumn::Y, sizeof(int32_t));
+    layout(SceneColumn::Width, sizeof(int32_t));
+    layout(SceneColumn::Height, sizeof(int32_t));
+    layout(SceneColumn::Color, sizeof(Color));
+    layout(SceneColumn::Z, sizeof(uint32_t));
+    layout(SceneColumn::Selected, sizeof(uint8_t));
+    layout(SceneColumn::Image, sizeof(uint32_t));
+    layout(SceneColumn::Id, sizeof(uint64_t));
+
+    auto flush = [&](Pending &column)
+    {
+      out.patch(column.offset, column.bytes.data(), column.bytes.size());
+      column.offset += column.bytes.size();
+      column.bytes.clear();
+    };
+    auto put = [&](Pending &column, const auto &value)
+    {
+      const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+      column.bytes.insert(column.bytes.end(), bytes, bytes + sizeof(value));
+      if (column.bytes.size() >= BATCH_BYTES)
+      {
+        flush(column);
+      }
+    };
+    walk([&](const Row &row) {
+      uint32_t image = row.image ? stringIndex.at(*row.image) : 0;
+      put(columns[0], row.x);
+      put(columns[1], row.y);
+      put(columns[2], row.w);
+      put(columns[3], row.h);
+      put(columns[4], row.color);
+      put(columns[5], row.z);
+      put(columns[6], row.selected);
+      put(columns[7], image);
+      put(columns[8], row.id);
+    });
+    for (Pending &column : columns)
+    {
+      flush(column);
+    }
+
+    std::string table;
+    for (const std::string &image : strings)
+    {
+      table += image;
+      table += '\0';
+    }
+    header.stringsOffset = out.position();
+    header.stringsSize = table.size();
+    out.write(table.data(), table.size());
+    out.patch(0, &header, sizeof(header));
+    out.commit();
+  }
+};
+
+int merge(const std::string &basePath, const std::string &oursPath,
+          const std::string &theirsPath, const std::string &outPath)
+{
+  SceneView base(basePath);
+  SceneView ours(oursPath);
+  SceneView theirs(theirsPath);
+  MergeWriter writer(base, ours, theirs);
+  writer.write(outPath);
+  std::cout << "Merged " << writer.objectCount() << " objects into "
+            << outPath << ", " << writer.conflictCount() << " conflicts"
+            << std::endl;
+  return writer.conflictCount() > 0 ? 1 : 0;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() >= 3 && args[0] == "diff")
+    {
+      bool summaryOnly = args[1] == "--summary";
+      if (args.size() == 3 + size_t(summaryOnly))
+      {
+        return diff(args[1 + summaryOnly], args[2 + summaryOnly], summaryOnly);
+      }
+    }
+    if (args.size() == 5 && args[0] == "merge")
+    {
+      return merge(args[1], args[2], args[3], args[4]);
+    }
+    std::cerr << "Usage: scene_diff diff [--summary] OLD NEW\n"
+                 "       scene_diff merge BASE OURS THEIRS OUT"
+              << std::endl;
+    return 2;
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 2;
+  }
+}
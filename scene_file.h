@@ -0,0 +1,377 @@
+// Binary scene file shared by multi_drag and its tools.
+//
+// Layout, all little-endian: a fixed SceneFileHeader, then each column as
+// a plain array starting on a SCENE_FILE_ALIGN boundary, then the image
+// path table (NUL-terminated paths, image ids in the image column are
+// 1-based indices into it). Columns are padded to a whole number of
+// SCENE_CHUNK_SIZE elements so they can be used in place, chunk by chunk,
+// from a mapping of the file.
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <io.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr char SCENE_FILE_MAGIC[8] = {'M', 'D', 'S', 'C', 'E', 'N', 'E', 0};
+constexpr uint32_t SCENE_FILE_VERSION = 1;
+constexpr uint32_t SCENE_BYTE_ORDER = 0x01020304;
+constexpr uint64_t SCENE_FILE_ALIGN = 4096;
+constexpr uint64_t SCENE_CHUNK_SIZE = uint64_t(1) << 16;
+constexpr uint32_t SCENE_MAX_COLUMNS = 16;
+
+enum class SceneColumn : uint32_t
+{
+  X = 1,
+  Y,
+  Width,
+  Height,
+  Color, // r, g, b, a bytes
+  Z,
+  Selected,
+  Image,
+  Id,
+  Deleted // nonzero for tombstones; all objects are live without it
+};
+
+struct SceneColumnEntry
+{
+  uint32_t column;      // SceneColumn, 0 for unused entries
+  uint32_t elementSize; // bytes per object
+  uint64_t offset;      // from the start of the file
+  uint64_t size;        // bytes, including padding
+};
+
+struct SceneFileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder; // SCENE_BYTE_ORDER as stored by the writer
+  uint64_t objectCount;
+  uint64_t nextId;
+  uint32_t nextZ;
+  uint32_t columnCount;
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+  SceneColumnEntry columns[SCENE_MAX_COLUMNS];
+};
+
+static_assert(sizeof(SceneColumnEntry) == 24, "column entry layout");
+static_assert(sizeof(SceneFileHeader) == 56 + 24 * SCENE_MAX_COLUMNS,
+              "header layout");
+
+// Bytes a column of count elements takes in the file
+inline uint64_t sceneColumnBytes(uint64_t count, uint32_t elementSize)
+{
+  uint64_t chunks = (count + SCENE_CHUNK_SIZE - 1) / SCENE_CHUNK_SIZE;
+  return chunks * SCENE_CHUNK_SIZE * elementSize;
+}
+
+// A whole file mapped copy-on-write: pages are read on first touch and
+// writes stay private to the process. On Windows the file is read into
+// memory instead: a mapped file cannot be replaced there, and scenes are
+// saved over the file they were loaded from.
+class MappedFile
+{
+private:
+  uint8_t *bytes = nullptr;
+  size_t length = 0;
+
+public:
+  explicit MappedFile(const std::string &path)
+  {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    LARGE_INTEGER size;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size))
+    {
+      if (file != INVALID_HANDLE_VALUE)
+      {
+        CloseHandle(file);
+      }
+      throw std::runtime_error("Cannot open " + path);
+    }
+    length = static_cast<size_t>(size.QuadPart);
+    // Page aligned like a mapping, which the column offsets rely on
+    bytes = length ? static_cast<uint8_t *>(VirtualAlloc(
+                         nullptr, length, MEM_COMMIT | MEM_RESERVE,
+                         PAGE_READWRITE))
+                   : nullptr;
+    size_t done = 0;
+    while (bytes && done < length)
+    {
+      DWORD want = static_cast<DWORD>(
+          std::min<size_t>(length - done, size_t(1) << 30));
+      DWORD got = 0;
+      if (!ReadFile(file, bytes + done, want, &got, nullptr) || got == 0)
+      {
+        break;
+      }
+      done += got;
+    }
+    CloseHandle(file);
+    if (done < length || !bytes)
+    {
+      if (bytes)
+      {
+        VirtualFree(bytes, 0, MEM_RELEASE);
+      }
+      throw std::runtime_error("Cannot map " + path);
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      throw std::runtime_error("Cannot open " + path);
+    }
+    length = static_cast<size_t>(info.st_size);
+    void *view = length ? mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE, fd, 0)
+                        : MAP_FAILED;
+    close(fd);
+    if (view == MAP_FAILED)
+    {
+      throw std::runtime_error("Cannot map " + path);
+    }
+    bytes = static_cast<uint8_t *>(view);
+#endif
+  }
+
+  ~MappedFile()
+  {
+#if defined(_WIN32)
+    VirtualFree(bytes, 0, MEM_RELEASE);
+#else
+    munmap(bytes, length);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  uint8_t *data() const { return bytes; }
+  size_t size() const { return length; }
+};
+
+// fseek with 64-bit offsets, also where long is 32 bits
+inline bool seekFile(FILE *file, uint64_t offset, int origin = SEEK_SET)
+{
+#if defined(_WIN32)
+  return _fseeki64(file, static_cast<__int64>(offset), origin) == 0;
+#else
+  return fseeko(file, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+// Flushes a stream and waits until its data has reached the disk
+inline bool syncFile(FILE *file)
+{
+  if (std::fflush(file) != 0)
+  {
+    return false;
+  }
+#if defined(_WIN32)
+  return _commit(_fileno(file)) == 0;
+#else
+  return fsync(fileno(file)) == 0;
+#endif
+}
+
+// Waits until the entries of the directory holding path, e.g. a rename
+// into it, have reached the disk
+inline bool syncDirectory(const std::string &path)
+{
+#if defined(_WIN32)
+  (void)path;
+  return true; // renames use MOVEFILE_WRITE_THROUGH instead
+#else
+  size_t slash = path.find_last_of('/');
+  std::string directory = slash == std::string::npos ? "."
+                          : slash == 0               ? "/"
+                                                     : path.substr(0, slash);
+  int fd = open(directory.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  return synced;
+#endif
+}
+
+// Writes to a temporary file next to the target and renames it over the
+// target on commit(), so readers see either the old file or the new one.
+// commit() returns once the rename is durable, so files the new one makes
+// redundant can be deleted after it. The temporary file is removed if the
+// writer is destroyed uncommitted.
+class AtomicFile
+{
+private:
+  std::string path;
+  std::string tempPath;
+  FILE *out = nullptr;
+  uint64_t written = 0;
+
+public:
+  explicit AtomicFile(const std::string &target)
+      : path(target), tempPath(target + ".tmp")
+  {
+    out = std::fopen(tempPath.c_str(), "wb");
+    if (!out)
+    {
+      throw std::runtime_error("Cannot write " + tempPath);
+    }
+  }
+
+  ~AtomicFile()
+  {
+    if (out)
+    {
+      std::fclose(out);
+      std::remove(tempPath.c_str());
+    }
+  }
+
+  AtomicFile(const AtomicFile &) = delete;
+  AtomicFile &operator=(const AtomicFile &) = delete;
+
+  uint64_t position() const { return written; }
+
+  void write(const void *data, size_t size)
+  {
+    if (size && std::fwrite(data, 1, size, out) != size)
+    {
+      throw std::runtime_error("Cannot write " + tempPath);
+    }
+    written += size;
+  }
+
+  // Writes zeros up to the given position
+  void padTo(uint64_t target)
+  {
+    static const char zeros[4096] = {};
+    while (written < target)
+    {
+      write(zeros, static_cast<size_t>(
+                       std::min<uint64_t>(sizeof(zeros), target - written)));
+    }
+  }
+
+  void align(uint64_t alignment)
+  {
+    padTo((written + alignment - 1) / alignment * alignment);
+  }
+
+  // Rewrites bytes already written, e.g. a header filled in last
+  void patch(uint64_t offset, const void *data, size_t size)
+  {
+    if (!seekFile(out, offset) || std::fwrite(data, 1, size, out) != size ||
+        !seekFile(out, 0, SEEK_END))
+    {
+      throw std::runtime_error("Cannot write " + tempPath);
+    }
+  }
+
+  void commit()
+  {
+    bool flushed = syncFile(out);
+    flushed = std::fclose(out) == 0 && flushed;
+    out = nullptr;
+#if defined(_WIN32)
+    bool renamed =
+        flushed && MoveFileExA(tempPath.c_str(), path.c_str(),
+                               MOVEFILE_REPLACE_EXISTING |
+                                   MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    bool renamed =
+        flushed && std::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!renamed)
+    {
+      std::remove(tempPath.c_str());
+      throw std::runtime_error("Cannot replace " + path);
+    }
+    if (!syncDirectory(path))
+    {
+      throw std::runtime_error("Cannot sync the directory of " + path);
+    }
+  }
+};
+
+// Checks a mapped scene file and returns its header; throws if the file
+// is not a scene this build can use in place
+inline const SceneFileHeader &sceneFileHeader(const MappedFile &file,
+                                              const std::string &path)
+{
+  if (file.size() < sizeof(SceneFileHeader))
+  {
+    throw std::runtime_error(path + " is not a scene file");
+  }
+  const SceneFileHeader &header =
+      *reinterpret_cast<const SceneFileHeader *>(file.data());
+  if (std::memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) != 0)
+  {
+    throw std::runtime_error(path + " is not a scene file");
+  }
+  if (header.version != SCENE_FILE_VERSION)
+  {
+    throw std::runtime_error(path + " has unsupported scene version " +
+                             std::to_string(header.version));
+  }
+  if (header.byteOrder != SCENE_BYTE_ORDER)
+  {
+    throw std::runtime_error(path + " was written with another byte order");
+  }
+  if (header.columnCount > SCENE_MAX_COLUMNS ||
+      header.stringsOffset > file.size() ||
+      header.stringsSize > file.size() - header.stringsOffset)
+  {
+    throw std::runtime_error(path + " is damaged");
+  }
+  for (uint32_t i = 0; i < header.columnCount; ++i)
+  {
+    const SceneColumnEntry &entry = header.columns[i];
+    if (entry.offset % SCENE_FILE_ALIGN != 0 || entry.offset > file.size() ||
+        entry.size > file.size() - entry.offset ||
+        entry.size < sceneColumnBytes(header.objectCount, entry.elementSize))
+    {
+      throw std::runtime_error(path + " is damaged");
+    }
+  }
+  return header;
+}
+
+// The entry of a column, or nullptr if the file lacks it
+inline const SceneColumnEntry *findSceneColumn(const SceneFileHeader &header,
+                                               SceneColumn column)
+{
+  for (uint32_t i = 0; i < header.columnCount; ++i)
+  {
+    if (header.columns[i].column == static_cast<uint32_t>(column))
+    {
+      return &header.columns[i];
+    }
+  }
+  return nullptr;
+}
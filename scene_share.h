@@ -0,0 +1,241 @@
+// Live scene published by multi_drag --share in a POSIX shared memory
+// segment, and a reader for it. Readers map the segment and use the
+// columns in place; nothing is copied or sent per read.
+//
+// Layout: a SharedSceneHeader, then one array per SharedColumn, each with
+// room for capacity objects and starting on a 64 byte boundary. The
+// writer brackets every update with the header's sequence counter: it is
+// odd while an update is in progress and advances by two per update, so a
+// reader that sees the same even value before and after reading has seen
+// one consistent state (a seqlock). Updates copy only the chunks of each
+// column changed since the last one. The segment only grows: when the
+// capacity does, the columns move, and readers remap. POSIX only.
+#pragma once
+
+#if !defined(_WIN32)
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+constexpr char SHARED_SCENE_MAGIC[8] = {'M', 'D', 'S', 'H', 'A', 'R', 'E', 0};
+constexpr uint32_t SHARED_SCENE_VERSION = 1;
+constexpr uint64_t SHARED_SCENE_ALIGN = 64;
+
+enum SharedColumn : uint32_t
+{
+  SHARED_X,
+  SHARED_Y,
+  SHARED_WIDTH,
+  SHARED_HEIGHT,
+  SHARED_COLOR, // r, g, b, a bytes
+  SHARED_Z,
+  SHARED_SELECTED,
+  SHARED_DELETED, // nonzero for tombstones
+  SHARED_ID,
+  SHARED_COLUMN_COUNT
+};
+
+constexpr uint32_t SHARED_COLUMN_SIZES[SHARED_COLUMN_COUNT] = {4, 4, 4, 4, 4,
+                                                               4, 1, 1, 8};
+
+struct SharedSceneHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  std::atomic<uint64_t> sequence; // odd while the writer updates
+  uint64_t capacity;              // objects the columns have room for
+  uint64_t objectCount;
+  uint64_t epoch; // number of updates published
+  uint64_t columns[SHARED_COLUMN_COUNT]; // offsets from the segment start
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the sequence counter is shared between processes");
+
+// Column offsets for a capacity; returns the segment size
+inline uint64_t sharedSceneLayout(uint64_t capacity,
+                                  uint64_t (&offsets)[SHARED_COLUMN_COUNT])
+{
+  uint64_t at = sizeof(SharedSceneHeader);
+  for (uint32_t column = 0; column < SHARED_COLUMN_COUNT; ++column)
+  {
+    at = (at + SHARED_SCENE_ALIGN - 1) / SHARED_SCENE_ALIGN *
+         SHARED_SCENE_ALIGN;
+    offsets[column] = at;
+    at += capacity * SHARED_COLUMN_SIZES[column];
+  }
+  return at;
+}
+
+// Maps a segment published by multi_drag --share read-only. read() hands
+// out the columns in place; usage:
+//
+//   SharedSceneReader scene("/multi_drag");
+//   scene.read([&](const SharedSceneReader::View &view) {
+//     for (uint64_t i = 0; i < view.count; ++i) ... view.x[i] ...
+//   });
+class SharedSceneReader
+{
+public:
+  struct View
+  {
+    uint64_t count;
+    uint64_t epoch;
+    const int32_t *x, *y, *w, *h;
+    const uint8_t *color; // 4 bytes per object
+    const uint32_t *z;
+    const uint8_t *selected;
+    const uint8_t *deleted;
+    const uint64_t *id;
+  };
+
+private:
+  int fd = -1;
+  const uint8_t *bytes = nullptr;
+  size_t length = 0;
+
+  void map()
+  {
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+      throw std::runtime_error("Cannot read the shared scene");
+    }
+    if (bytes)
+    {
+      munmap(const_cast<uint8_t *>(bytes), length);
+      bytes = nullptr;
+    }
+    length = static_cast<size_t>(info.st_size);
+    void *view = length >= sizeof(SharedSceneHeader)
+                     ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0)
+                     : MAP_FAILED;
+    if (view == MAP_FAILED)
+    {
+      throw std::runtime_error("Cannot map the shared scene");
+    }
+    bytes = static_cast<const uint8_t *>(view);
+  }
+
+  void release()
+  {
+    if (bytes)
+    {
+      munmap(const_cast<uint8_t *>(bytes), length);
+    }
+    close(fd);
+  }
+
+  const SharedSceneHeader &header() const
+  {
+    return *reinterpret_cast<const SharedSceneHeader *>(bytes);
+  }
+
+public:
+  explicit SharedSceneReader(const std::string &name)
+  {
+    fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Cannot open shared scene " + name);
+    }
+    try
+    {
+      map();
+      if (std::memcmp(header().magic, SHARED_SCENE_MAGIC,
+                      sizeof(header().magic)) != 0 ||
+          header().version != SHARED_SCENE_VERSION ||
+          header().headerSize != sizeof(SharedSceneHeader))
+      {
+        throw std::runtime_error(name + " is not a shared scene this "
+                                        "reader understands");
+      }
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+  }
+
+  ~SharedSceneReader() { release(); }
+
+  SharedSceneReader(const SharedSceneReader &) = delete;
+  SharedSceneReader &operator=(const SharedSceneReader &) = delete;
+
+  // Calls visit(view) on a consistent state of the scene. visit may run
+  // more than once: a run that overlapped an update is repeated, and only
+  // the last one's results should be kept. The view is only valid inside
+  // visit, and a run to be repeated may see torn values, though never
+  // pointers outside the mapping.
+  template <typename Visit> void read(Visit &&visit)
+  {
+    while (true)
+    {
+      const SharedSceneHeader &shared = header();
+      uint64_t begin = shared.sequence.load(std::memory_order_acquire);
+      if (begin & 1)
+      {
+        std::this_thread::yield();
+        continue;
+      }
+      uint64_t capacity = shared.capacity;
+      View view{};
+      view.count = shared.objectCount;
+      view.epoch = shared.epoch;
+      uint64_t offsets[SHARED_COLUMN_COUNT];
+      bool inside = view.count <= capacity;
+      for (uint32_t column = 0; column < SHARED_COLUMN_COUNT; ++column)
+      {
+        offsets[column] = shared.columns[column];
+        inside = inside && offsets[column] <= length &&
+                 capacity <= (length - offsets[column]) /
+                                 SHARED_COLUMN_SIZES[column];
+      }
+      if (!inside)
+      {
+        // Torn, or the segment grew since it was mapped
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared.sequence.load(std::memory_order_relaxed) == begin)
+        {
+          size_t mapped = length;
+          map();
+          if (length == mapped)
+          {
+            throw std::runtime_error("The shared scene is damaged");
+          }
+        }
+        continue;
+      }
+      view.x = reinterpret_cast<const int32_t *>(bytes + offsets[SHARED_X]);
+      view.y = reinterpret_cast<const int32_t *>(bytes + offsets[SHARED_Y]);
+      view.w =
+          reinterpret_cast<const int32_t *>(bytes + offsets[SHARED_WIDTH]);
+      view.h =
+          reinterpret_cast<const int32_t *>(bytes + offsets[SHARED_HEIGHT]);
+      view.color = bytes + offsets[SHARED_COLOR];
+      view.z = reinterpret_cast<const uint32_t *>(bytes + offsets[SHARED_Z]);
+      view.selected = bytes + offsets[SHARED_SELECTED];
+      view.deleted = bytes + offsets[SHARED_DELETED];
+      view.id = reinterpret_cast<const uint64_t *>(bytes + offsets[SHARED_ID]);
+      visit(static_cast<const View &>(view));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (shared.sequence.load(std::memory_order_relaxed) == begin)
+      {
+        return;
+      }
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,143 @@
+// Example reader of the scene multi_drag publishes with --share: prints a
+// summary of the live objects twice a second, and with an id, where that
+// object is. Reads the shared columns in place through scene_share.h.
+//
+// Compile with (not on Windows, which --share does not support):
+// g++ -O2 scene_watch.cpp -o scene_watch -lrt
+//
+// Run with:
+// ./multi_drag --share /multi_drag
+// ./scene_watch /multi_drag [ID] [--once]
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "scene_share.h"
+
+#if defined(_WIN32)
+#error "scene_watch needs POSIX shared memory, which Windows does not have"
+#endif
+
+namespace
+{
+struct Summary
+{
+  uint64_t epoch = 0;
+  uint64_t live = 0;
+  uint64_t selected = 0;
+  int32_t x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+  bool found = false; // whether the watched id is live
+  int32_t x = 0, y = 0, w = 0, h = 0;
+};
+
+Summary summarize(const SharedSceneReader::View &view, uint64_t watched)
+{
+  Summary summary;
+  summary.epoch = view.epoch;
+  for (uint64_t i = 0; i < view.count; ++i)
+  {
+    if (view.deleted[i])
+    {
+      continue;
+    }
+    ++summary.live;
+    summary.selected += view.selected[i] != 0;
+    summary.x0 = std::min(summary.x0, view.x[i]);
+    summary.y0 = std::min(summary.y0, view.y[i]);
+    summary.x1 = std::max(summary.x1, view.x[i] + view.w[i]);
+    summary.y1 = std::max(summary.y1, view.y[i] + view.h[i]);
+  }
+  // Ids ascend with the slot
+  const uint64_t *slot = std::lower_bound(view.id, view.id + view.count,
+                                          watched);
+  if (watched && slot != view.id + view.count && *slot == watched &&
+      !view.deleted[slot - view.id])
+  {
+    uint64_t i = static_cast<uint64_t>(slot - view.id);
+    summary.found = true;
+    summary.x = view.x[i];
+    summary.y = view.y[i];
+    summary.w = view.w[i];
+    summary.h = view.h[i];
+  }
+  return summary;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+  try
+  {
+    std::string name;
+    uint64_t watched = 0;
+    bool once = false;
+    for (int i = 1; i < argc; ++i)
+    {
+      std::string arg = argv[i];
+      if (arg == "--once")
+      {
+        once = true;
+      }
+      else if (name.empty())
+      {
+        name = arg;
+      }
+      else
+      {
+        watched = std::stoull(arg);
+      }
+    }
+    if (name.empty())
+    {
+      std::cerr << "Usage: scene_watch NAME [ID] [--once]" << std::endl;
+      return 2;
+    }
+
+    SharedSceneReader scene(name);
+    uint64_t lastEpoch = UINT64_MAX;
+    while (true)
+    {
+      Summary summary;
+      scene.read([&](const SharedSceneReader::View &view)
+                 { summary = summarize(view, watched); });
+      if (summary.epoch != lastEpoch)
+      {
+        lastEpoch = summary.epoch;
+        std::printf("epoch %llu: %llu objects, %llu selected",
+                    (unsigned long long)summary.epoch,
+                    (unsigned long long)summary.live,
+                    (unsigned long long)summary.selected);
+        if (summary.live > 0)
+        {
+          std::printf(", within %d,%d-%d,%d", summary.x0, summary.y0,
+                      summary.x1, summary.y1);
+        }
+        if (summary.found)
+        {
+          std::printf(", #%llu at %d,%d %dx%d", (unsigned long long)watched,
+                      summary.x, summary.y, summary.w, summary.h);
+        }
+        else if (watched)
+        {
+          std::printf(", #%llu absent", (unsigned long long)watched);
+        }
+        std::printf("\n");
+        std::fflush(stdout);
+      }
+      if (once)
+      {
+        return 0;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    }
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+}